@@ -0,0 +1,117 @@
+/*
+ * capture.c - part of USBasp
+ *
+ * Description....: Samples the ISP lines and run-length encodes
+ *                  their transitions into a ring buffer
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include "isp.h"
+#include "clock.h"
+#include "capture.h"
+
+#ifdef USBASP_CAPTURE
+
+static uchar capture_buffer[CAPTURE_BUFFER_SIZE];
+static uchar capture_head, capture_tail;
+static uchar capture_status;
+static uchar capture_pins;
+static uint16_t capture_run;
+static uint16_t capture_period;
+static uint16_t capture_next;
+static uint16_t capture_remaining;
+static uint16_t capture_missed;
+
+#define capturePins() ((ISP_IN >> ISP_RST) & 0x0F)
+
+static void captureStore() {
+	uchar next = (capture_head + 2) & (CAPTURE_BUFFER_SIZE - 1);
+
+	if (next == capture_tail) {
+		/* host did not keep up, stop here */
+		capture_status = (capture_status & ~CAPTURE_ACTIVE) | CAPTURE_OVERFLOW;
+		return;
+	}
+	capture_buffer[capture_head] = (capture_pins << 4) | (capture_run >> 8);
+	capture_buffer[capture_head + 1] = capture_run;
+	capture_head = next;
+}
+
+void captureStart(uint16_t period, uint16_t samples) {
+
+	capture_head = capture_tail = 0;
+	capture_period = period < CAPTURE_PERIOD_MIN ? CAPTURE_PERIOD_MIN : period;
+	capture_remaining = samples;
+	capture_missed = 0;
+	capture_pins = capturePins();
+	capture_run = 0;
+	capture_status = CAPTURE_ACTIVE;
+
+	/* timer 1 free running at F_CPU/8 */
+	clockMeasureStart();
+	capture_next = TCNT1;
+}
+
+uchar captureStop() {
+
+	if ((capture_status & CAPTURE_ACTIVE) && capture_run) {
+		captureStore();
+	}
+	capture_status &= ~CAPTURE_ACTIVE;
+
+	return capture_status;
+}
+
+uint16_t captureMissed() {
+	return capture_missed;
+}
+
+void captureRun() {
+	uchar pins;
+	uchar burst = CAPTURE_BURST;
+	uint16_t late;
+
+	/* samples delayed by interrupts are taken late, but counted in time */
+	while ((capture_status & CAPTURE_ACTIVE)
+			&& (int16_t) (TCNT1 - capture_next) >= 0) {
+		if (burst-- == 0) {
+			/* too far behind, skip to now so USB is served */
+			late = (TCNT1 - capture_next) / capture_period + 1;
+			capture_next += late * capture_period;
+			capture_missed += late;
+			capture_status |= CAPTURE_MISSED;
+			break;
+		}
+		capture_next += capture_period;
+
+		pins = capturePins();
+		if (pins != capture_pins || capture_run == CAPTURE_RUN_MAX) {
+			captureStore();
+			capture_pins = pins;
+			capture_run = 0;
+		}
+		capture_run++;
+
+		if (capture_remaining && --capture_remaining == 0) {
+			captureStop();
+		}
+	}
+}
+
+uchar captureRead(uchar *data, uchar len) {
+	uchar i;
+
+	/* whole entries only */
+	len &= ~1;
+	for (i = 0; i < len && capture_tail != capture_head; i++) {
+		data[i] = capture_buffer[capture_tail];
+		capture_tail = (capture_tail + 1) & (CAPTURE_BUFFER_SIZE - 1);
+	}
+
+	return i;
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * capture.h - part of USBasp
+ *
+ * Description....: Samples the ISP lines and run-length encodes
+ *                  their transitions into a ring buffer
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __capture_h_included__
+#define	__capture_h_included__
+
+#ifndef uchar
+#define	uchar	unsigned char
+#endif
+
+/* ring buffer size, must be a power of two */
+#define CAPTURE_BUFFER_SIZE  128
+
+/* Entries are two bytes: pins in high nibble of first byte (bit 0 = RST,
+ * 1 = MOSI, 2 = MISO, 3 = SCK), number of samples (12 bit) below */
+#define CAPTURE_RUN_MAX      0x0FFF
+
+/* shortest sample period in timer 1 counts (~10 us) */
+#define CAPTURE_PERIOD_MIN   16
+
+/* samples taken at most per captureRun() call when behind */
+#define CAPTURE_BURST        16
+
+/* status flags */
+#define CAPTURE_ACTIVE       0x01
+#define CAPTURE_OVERFLOW     0x02	/* buffer full, sampling stopped */
+#define CAPTURE_MISSED       0x04	/* samples skipped, see captureMissed() */
+
+/* Start sampling every period timer 1 counts (F_CPU/8), stop after
+ * samples (0 = until stopped) */
+void captureStart(uint16_t period, uint16_t samples);
+
+/* Stop sampling and flush current run, returns status flags */
+uchar captureStop();
+
+/* Take samples that are due, call from main loop */
+void captureRun();
+
+/* Number of samples skipped because the main loop was late */
+uint16_t captureMissed();
+
+/* Copy up to len bytes of complete entries, return count */
+uchar captureRead(uchar *data, uchar len);
+
+#endif /* __capture_h_included__ */
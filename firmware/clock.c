@@ -22,3 +22,32 @@ void clockWait(uint8_t time) {
 		}
 	}
 }
+
+/* wait ticks * 5.33 us */
+void clockWaitTicks(uint16_t ticks) {
+
+	uint16_t elapsed = 0;
+	uint8_t lasttime = TIMERVALUE;
+	while (elapsed < ticks) {
+		uint8_t now = TIMERVALUE;
+		elapsed += (uint8_t) (now - lasttime);
+		lasttime = now;
+	}
+}
+
+void clockMeasureStart() {
+	TCCR1A = 0;
+	TCCR1B = 0;
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1);
+	TCCR1B = (1 << CS11);
+}
+
+uint16_t clockMeasureStop() {
+	uint16_t counts = TCNT1;
+	TCCR1B = 0;
+	if (TIFR1 & (1 << TOV1)) {
+		return 0xffff;
+	}
+	return counts;
+}
@@ -15,8 +15,13 @@
 #define TIMERVALUE      TCNT0
 #define CLOCK_T_320us	60
 
+/* convert microseconds to timer ticks (5.33 us) */
+#define CLOCK_US_TO_TICKS(us) ((uint16_t) (((uint32_t) (us) * 3) >> 4))
+
 #ifdef __AVR_ATmega8__
 #define TCCR0B  TCCR0
+#define TIFR1   TIFR
+#define TIMSK0  TIMSK
 #endif
 
 /* set prescaler to 64 */
@@ -25,4 +30,13 @@
 /* wait time * 320 us */
 void clockWait(uint8_t time);
 
+/* wait ticks * 5.33 us */
+void clockWaitTicks(uint16_t ticks);
+
+/* start measurement with timer 1, counts F_CPU/8 (0.67 us, max 43 ms) */
+void clockMeasureStart();
+
+/* stop measurement, return counts or 0xffff on overflow */
+uint16_t clockMeasureStop();
+
 #endif /* __clock_h_included__ */
@@ -0,0 +1,281 @@
+/*
+ * dw.c - part of USBasp
+ *
+ * Description....: Provides debugWIRE memory reads and disabling of
+ *                  debugWIRE over RST. Interrupts are disabled while a
+ *                  byte is sent or an answer is received, functions must
+ *                  be called outside of USB transfers
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "isp.h"
+#include "clock.h"
+#include "dw.h"
+
+#ifdef USBASP_DW
+
+/* 8 bit times in timer 1 counts (F_CPU/8) */
+static uint16_t dw_span;
+
+/* open drain, target has pull-up on RST */
+#define dwLow()    { ISP_OUT &= ~(1 << DW_LINE); ISP_DDR |= (1 << DW_LINE); }
+#define dwHigh()   { ISP_DDR &= ~(1 << DW_LINE); ISP_OUT |= (1 << DW_LINE); }
+#define dwLevel()  (ISP_IN & (1 << DW_LINE))
+
+/* wait for line level (0 = start bit), returns 0 if found */
+static uchar dwWaitLevel(uchar high) {
+	uchar timeout = DW_T_RECV;
+	uint8_t starttime = TIMERVALUE;
+
+	while (!dwLevel() != !high) {
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			if (--timeout == 0) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* wait until time (in 1/8 bit time units of dw_span) after start */
+static void dwWaitUntil(uint16_t start, uint32_t eighths) {
+	uint16_t t = eighths >> 3;
+
+	while ((uint16_t) (TCNT1 - start) < t)
+		;
+}
+
+static void dwSendByte(uchar b) {
+	uint16_t start = TCNT1;
+	uint32_t t = 0;
+	uchar i;
+
+	/* start bit, 8 data bits, stop bit */
+	dwLow();
+	t += dw_span;
+	dwWaitUntil(start, t);
+	for (i = 0; i < 8; i++) {
+		if (b & 1) {
+			dwHigh();
+		} else {
+			dwLow();
+		}
+		b >>= 1;
+		t += dw_span;
+		dwWaitUntil(start, t);
+	}
+	dwHigh();
+	t += dw_span;
+	dwWaitUntil(start, t);
+}
+
+/* send bytes, interrupts are enabled between them. Returns with
+ * interrupts disabled so the answer to the last byte is not missed,
+ * caller enables them when done */
+static void dwSend(const uchar *data, uchar len) {
+	while (len--) {
+		cli();
+		dwSendByte(*data++);
+		if (len) {
+			sei();
+		}
+	}
+}
+
+static uchar dwRecvByte(uchar *b) {
+	uint16_t start;
+	uint32_t t;
+	uchar i;
+
+	if (dwWaitLevel(0)) {
+		return 1;
+	}
+	start = TCNT1;
+
+	/* sample in the middle of data bits */
+	t = dw_span + (dw_span >> 1);
+	for (i = 0; i < 8; i++) {
+		dwWaitUntil(start, t);
+		*b >>= 1;
+		if (dwLevel()) {
+			*b |= 0x80;
+		}
+		t += dw_span;
+	}
+
+	/* stop bit */
+	dwWaitUntil(start, t);
+	return dwLevel() ? 0 : 1;
+}
+
+static uchar dwRecv(uchar *data, uchar len) {
+	while (len--) {
+		if (dwRecvByte(data++)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* set registers first.. from data */
+static void dwWriteRegs(uchar first, const uchar *data, uchar len) {
+	uchar cmd[] = { DW_CMD_CONTEXT_MEM, DW_CMD_SET_PC, 0, first,
+			DW_CMD_SET_BP, 0, first + len, DW_CMD_MODE, DW_MODE_WRITE_REGS,
+			DW_CMD_GO };
+
+	dwSend(cmd, sizeof(cmd));
+	sei();
+	dwSend(data, len);
+	sei();
+}
+
+/* execute one instruction on target */
+static void dwExecute(unsigned int instruction) {
+	uchar cmd[] = { DW_CMD_CONTEXT_INST, DW_CMD_SET_IR, instruction >> 8,
+			instruction, DW_CMD_EXEC };
+
+	dwSend(cmd, sizeof(cmd));
+	sei();
+}
+
+/* start block transfer of len bytes in given mode, from address in Z or
+ * registers starting at first, returns with interrupts disabled */
+static void dwBlock(uchar mode, uchar first, uchar len) {
+	uchar cmd[] = { DW_CMD_CONTEXT_MEM, DW_CMD_SET_PC, 0, first,
+			DW_CMD_SET_BP, 0, 0, DW_CMD_MODE, mode, DW_CMD_GO };
+
+	if (mode == DW_MODE_READ_REGS) {
+		cmd[6] = first + len;
+	} else {
+		cmd[5] = (len << 1) >> 8;
+		cmd[6] = len << 1;
+	}
+	dwSend(cmd, sizeof(cmd));
+}
+
+/* OUT A, Rr and IN Rd, A */
+#define DW_OUT(a, r)  (0xB800 | (((a) & 0x30) << 5) | ((r) << 4) | ((a) & 0x0F))
+#define DW_IN(r, a)   (0xB000 | (((a) & 0x30) << 5) | ((r) << 4) | ((a) & 0x0F))
+#define DW_ADIW_Z_1   0x9631
+
+static uchar dwReadEEPROM(unsigned int address, uchar *buffer, uchar len,
+		uchar eecr) {
+	/* r28 = EERE, r30:r31 = address */
+	uchar regs[] = { 0x01, 0x01, address, address >> 8 };
+
+	dwWriteRegs(28, regs, sizeof(regs));
+	while (len--) {
+		dwExecute(DW_OUT(eecr + 3, 31));
+		dwExecute(DW_OUT(eecr + 2, 30));
+		dwExecute(DW_OUT(eecr, 28));
+		dwExecute(DW_IN(0, eecr + 1));
+		dwBlock(DW_MODE_READ_REGS, 0, 1);
+		if (dwRecvByte(buffer++)) {
+			sei();
+			return 1;
+		}
+		sei();
+		dwExecute(DW_ADIW_Z_1);
+	}
+	return 0;
+}
+
+/* measure 0x55 answer to break: falling edges at bit 0, 2, 4, 6 and 8 */
+static uchar dwMeasure() {
+	uint16_t start;
+	uchar i;
+
+	if (dwWaitLevel(0)) {
+		return 1;
+	}
+	start = TCNT1;
+	for (i = 0; i < 4; i++) {
+		if (dwWaitLevel(1) || dwWaitLevel(0)) {
+			return 1;
+		}
+	}
+	dw_span = TCNT1 - start;
+
+	return dwWaitLevel(1);
+}
+
+uchar dwConnect(uchar *buffer) {
+	uchar result = 0;
+	uchar cmd = DW_CMD_SIGNATURE;
+
+	clockMeasureStart();
+
+	/* break, USB is served meanwhile */
+	dwLow();
+	clockWait(DW_T_BREAK);
+
+	/* 0x55 answer follows release at once */
+	cli();
+	dwHigh();
+	if (dwMeasure() == 0) {
+		sei();
+		buffer[0] = dw_span;
+		buffer[1] = dw_span >> 8;
+		dwSend(&cmd, 1);
+		if (dwRecv(&buffer[2], 2) == 0) {
+			result = 4;
+		}
+	}
+
+	sei();
+	return result;
+}
+
+uchar dwRead(uchar memtype, unsigned int address, uchar *buffer, uchar len,
+		uchar eecr) {
+	uchar z[2];
+	uchar chunk, n;
+	uint16_t window;
+
+	clockMeasureStart();
+
+	if (memtype == DW_MEM_EEPROM) {
+		return dwReadEEPROM(address, buffer, len, eecr);
+	}
+
+	/* one block per chunk, answer must not keep USB waiting too long */
+	window = dw_span ? DW_T_WINDOW / (dw_span + (dw_span >> 2)) : 1;
+	chunk = window == 0 ? 1 : window > 255 ? 255 : window;
+
+	while (len) {
+		n = len < chunk ? len : chunk;
+		z[0] = address;
+		z[1] = address >> 8;
+		dwWriteRegs(30, z, sizeof(z));
+		if (memtype == DW_MEM_FLASH) {
+			dwBlock(DW_MODE_READ_FLASH, 0, n);
+		} else {
+			dwBlock(DW_MODE_READ_SRAM, 0, n);
+		}
+		if (dwRecv(buffer, n)) {
+			sei();
+			return 1;
+		}
+		sei();
+		address += n;
+		buffer += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+void dwDisable() {
+	uchar cmd = DW_CMD_DISABLE;
+
+	clockMeasureStart();
+	dwSend(&cmd, 1);
+	sei();
+}
+
+#endif
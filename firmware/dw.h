@@ -0,0 +1,62 @@
+/*
+ * dw.h - part of USBasp
+ *
+ * Description....: Provides debugWIRE memory reads and disabling of
+ *                  debugWIRE over RST. Interrupts are disabled while a
+ *                  byte is sent or an answer is received, functions must
+ *                  be called outside of USB transfers
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __dw_h_included__
+#define	__dw_h_included__
+
+#define DW_LINE   ISP_RST
+
+/* debugWIRE commands */
+#define DW_CMD_DISABLE      0x06
+#define DW_CMD_SIGNATURE    0xF3
+#define DW_CMD_CONTEXT_MEM  0x66
+#define DW_CMD_CONTEXT_INST 0x64
+#define DW_CMD_SET_PC       0xD0
+#define DW_CMD_SET_BP       0xD1
+#define DW_CMD_SET_IR       0xD2
+#define DW_CMD_MODE         0xC2
+#define DW_CMD_GO           0x20
+#define DW_CMD_EXEC         0x23
+
+/* DW_CMD_MODE operations */
+#define DW_MODE_READ_SRAM   0x00
+#define DW_MODE_READ_REGS   0x01
+#define DW_MODE_READ_FLASH  0x02
+#define DW_MODE_WRITE_REGS  0x05
+
+/* memory types */
+#define DW_MEM_SRAM         0
+#define DW_MEM_FLASH        1
+#define DW_MEM_EEPROM       2
+
+/* timeouts in 320 us units */
+#define DW_T_BREAK          80	/* ~25 ms low */
+#define DW_T_RECV           100
+
+/* longest answer received with interrupts disabled, timer 1 counts */
+#define DW_T_WINDOW         3000	/* 2 ms */
+
+/* Send break and measure baud rate from the 0x55 response, then read
+ * signature. Writes 8 bit time (F_CPU/8 counts) and signature to buffer.
+ * Returns number of bytes in buffer, 0 on error */
+uchar dwConnect(uchar *buffer);
+
+/* Read len bytes of memtype from address. Registers r28-r31 of target
+ * are changed. EEPROM reads need the I/O address of EECR (EEDR, EEARL,
+ * EEARH follow). Returns 0 on success */
+uchar dwRead(uchar memtype, unsigned int address, uchar *buffer, uchar len,
+		uchar eecr);
+
+/* Disable debugWIRE until next power cycle, ISP is available then */
+void dwDisable();
+
+#endif /* __dw_h_included__ */
@@ -0,0 +1,233 @@
+/*
+ * i2c.c - part of USBasp
+ *
+ * Description....: Provides functions for serial EEPROMs (24Cxx) over I2C,
+ *                  bit-banged on ISP interface (SCL = SCK, SDA = MOSI)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include <util/delay_basic.h>
+#include "isp.h"
+#include "clock.h"
+#include "i2c.h"
+
+#ifdef USBASP_I2C
+
+static uchar i2c_delay;
+static uchar i2c_device;
+static uchar i2c_flags;
+static uchar i2c_writing;
+
+/* open drain: low = output low, high = input with pull-up */
+#define i2cLow(bit)   { ISP_OUT &= ~(1 << (bit)); ISP_DDR |= (1 << (bit)); }
+#define i2cHigh(bit)  { ISP_DDR &= ~(1 << (bit)); ISP_OUT |= (1 << (bit)); }
+
+static void i2cDelay() {
+	if (i2c_delay) {
+		_delay_loop_1(i2c_delay);
+	}
+}
+
+/* release SCL, wait while slave stretches clock */
+static void i2cSCLHigh() {
+	uchar timeout = 255;
+
+	i2cHigh(I2C_SCL);
+	while (!(ISP_IN & (1 << I2C_SCL)) && --timeout)
+		;
+	i2cDelay();
+}
+
+static void i2cStart() {
+	i2cHigh(I2C_SDA);
+	i2cSCLHigh();
+	i2cLow(I2C_SDA);
+	i2cDelay();
+	i2cLow(I2C_SCL);
+}
+
+static void i2cStop() {
+	i2cLow(I2C_SDA);
+	i2cDelay();
+	i2cSCLHigh();
+	i2cHigh(I2C_SDA);
+	i2cDelay();
+}
+
+/* send byte, return 0 if acknowledged */
+static uchar i2cWrite(uchar b) {
+	uchar i, nack;
+
+	for (i = 0; i < 8; i++) {
+		if (b & 0x80) {
+			i2cHigh(I2C_SDA);
+		} else {
+			i2cLow(I2C_SDA);
+		}
+		b <<= 1;
+		i2cDelay();
+		i2cSCLHigh();
+		i2cLow(I2C_SCL);
+	}
+
+	/* ack bit */
+	i2cHigh(I2C_SDA);
+	i2cDelay();
+	i2cSCLHigh();
+	nack = ISP_IN & (1 << I2C_SDA);
+	i2cLow(I2C_SCL);
+
+	return nack;
+}
+
+static uchar i2cRead(uchar ack) {
+	uchar i, b = 0;
+
+	i2cHigh(I2C_SDA);
+	for (i = 0; i < 8; i++) {
+		i2cDelay();
+		i2cSCLHigh();
+		b <<= 1;
+		if (ISP_IN & (1 << I2C_SDA)) {
+			b |= 1;
+		}
+		i2cLow(I2C_SCL);
+	}
+
+	/* ack bit */
+	if (ack) {
+		i2cLow(I2C_SDA);
+	}
+	i2cDelay();
+	i2cSCLHigh();
+	i2cLow(I2C_SCL);
+	i2cHigh(I2C_SDA);
+
+	return b;
+}
+
+/* device address with upper memory address bits for one byte addressing */
+static uchar i2cDeviceAddress(unsigned int address) {
+	if (i2c_flags & I2C_ADDR16) {
+		return i2c_device << 1;
+	}
+	return (i2c_device | ((address >> 8) & 0x07)) << 1;
+}
+
+/* address device and memory location for writing, release bus on error */
+static uchar i2cAddress(unsigned int address) {
+
+	i2cStart();
+	if (i2cWrite(i2cDeviceAddress(address))
+			|| ((i2c_flags & I2C_ADDR16) && i2cWrite(address >> 8))
+			|| i2cWrite(address)) {
+		i2cStop();
+		return 1;
+	}
+	return 0;
+}
+
+void i2cConnect(uchar delay) {
+
+	i2c_delay = delay;
+	i2c_writing = 0;
+
+	/* no hardware SPI, release bus */
+	SPCR = 0;
+	i2cHigh(I2C_SDA);
+	i2cHigh(I2C_SCL);
+	i2cStop();
+}
+
+uchar i2cEepromReadStart(uchar device, uchar flags, unsigned int address) {
+
+	i2c_device = device;
+	i2c_flags = flags;
+
+	if (i2cAddress(address)) {
+		return 1;
+	}
+
+	/* repeated start for reading */
+	i2cStart();
+	if (i2cWrite(i2cDeviceAddress(address) | 1)) {
+		i2cStop();
+		return 1;
+	}
+	return 0;
+}
+
+uchar i2cEepromRead(uchar last) {
+	uchar b = i2cRead(!last);
+
+	if (last) {
+		i2cStop();
+	}
+	return b;
+}
+
+void i2cEepromWriteStart(uchar device, uchar flags) {
+	i2c_device = device;
+	i2c_flags = flags;
+	i2c_writing = 0;
+}
+
+uchar i2cEepromWriteByte(unsigned int address, uchar data) {
+
+	/* page write must not wrap around at page end */
+	if (i2c_writing && (address & (I2C_PAGESIZE(i2c_flags) - 1)) == 0) {
+		if (i2cEepromWriteEnd()) {
+			return 1;
+		}
+	}
+
+	if (!i2c_writing) {
+		if (i2cAddress(address)) {
+			return 1;
+		}
+		i2c_writing = 1;
+	}
+
+	if (i2cWrite(data)) {
+		i2cStop();
+		i2c_writing = 0;
+		return 1;
+	}
+	return 0;
+}
+
+uchar i2cEepromWriteEnd() {
+
+	uchar timeout = I2C_T_WRITE;
+	uint8_t starttime;
+
+	if (!i2c_writing) {
+		return 0;
+	}
+
+	i2cStop();
+	i2c_writing = 0;
+
+	/* ACK polling: device ignores its address while writing */
+	starttime = TIMERVALUE;
+	for (;;) {
+		i2cStart();
+		if (i2cWrite(i2c_device << 1) == 0) {
+			i2cStop();
+			return 0;
+		}
+		i2cStop();
+
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			if (--timeout == 0) {
+				return 1; /* error */
+			}
+		}
+	}
+}
+
+#endif
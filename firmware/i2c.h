@@ -0,0 +1,42 @@
+/*
+ * i2c.h - part of USBasp
+ *
+ * Description....: Provides functions for serial EEPROMs (24Cxx) over I2C,
+ *                  bit-banged on ISP interface (SCL = SCK, SDA = MOSI)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __i2c_h_included__
+#define	__i2c_h_included__
+
+#define I2C_SCL   ISP_SCK
+#define I2C_SDA   ISP_MOSI
+
+/* device addressing flags */
+#define I2C_ADDR16        0x01	/* two address bytes (24C32 and up) */
+#define I2C_PAGESIZE(f)   (1 << ((f) >> 4))	/* log2 of page size in high nibble */
+
+/* ACK polling timeout in 320 us units */
+#define I2C_T_WRITE       64	/* ~20 ms */
+
+/* Prepare I2C bus, delay is half bit time in 3 cycle units */
+void i2cConnect(uchar delay);
+
+/* start sequential read, return 0 if device acknowledged */
+uchar i2cEepromReadStart(uchar device, uchar flags, unsigned int address);
+
+/* read next byte, stop after last one */
+uchar i2cEepromRead(uchar last);
+
+/* write byte, page writes are started or continued as needed */
+uchar i2cEepromWriteByte(unsigned int address, uchar data);
+
+/* end page write and poll device until done, return 0 on success */
+uchar i2cEepromWriteEnd();
+
+/* set device for following writes */
+void i2cEepromWriteStart(uchar device, uchar flags);
+
+#endif /* __i2c_h_included__ */
@@ -16,6 +16,7 @@
 #include "isp.h"
 #include "clock.h"
 #include "usbasp.h"
+#include "trace.h"
 
 #define spiHWdisable() SPCR = 0
 
@@ -23,6 +24,16 @@ uchar sck_sw_delay;
 uchar sck_spcr;
 uchar sck_spsr;
 uchar isp_hiaddr;
+uchar isp_sck_option;
+uchar isp_echo_errors;
+uchar isp_echo_good;
+uchar isp_echo_failed;
+ispProfile isp_profile;
+ispCounters isp_counters;
+unsigned int isp_poll_ticks;	/* duration of last ispPollReady() */
+unsigned int isp_page_left;	/* S5x page mode: bytes left in transfer */
+uchar isp_page_write;		/* S5x page mode: write transfer */
+unsigned long isp_page_next;	/* S5x page mode: address of next byte */
 
 void spiHWenable() {
 	SPCR = sck_spcr;
@@ -34,6 +45,10 @@ void ispSetSCKOption(uchar option) {
 	if (option == USBASP_ISP_SCK_AUTO)
 		option = USBASP_ISP_SCK_375;
 
+	isp_sck_option = option;
+	isp_echo_errors = 0;
+	traceEvent(TRACE_SCK, option);
+
 	if (option >= USBASP_ISP_SCK_93_75) {
 		ispTransmit = ispTransmit_hw;
 		sck_spsr = 0;
@@ -99,10 +114,19 @@ void ispSetSCKOption(uchar option) {
 			break;
 		}
 	}
+}
 
-	if (chip == S5x) {
-	  ispTransmit = ispTransmit_sw;
-	  sck_sw_delay = 2;
+void ispSwitchSCKOption(uchar option) {
+
+	/* hand SCK/MOSI back to port while changing mode, SCK idles low */
+	spiHWdisable();
+	ISP_OUT &= ~(1 << ISP_SCK);
+
+	ispSetSCKOption(option);
+
+	/* reenable hardware SPI only if connected */
+	if ((ISP_DDR & (1 << ISP_SCK)) && (ispTransmit == ispTransmit_hw)) {
+		spiHWenable();
 	}
 }
 
@@ -150,6 +174,20 @@ void ispConnect() {
 	isp_hiaddr = 0;
 }
 
+#ifdef USBASP_SPI
+void ispConnectSPI() {
+
+	/* chip select inactive, SCK idles low */
+	ISP_OUT |= (1 << ISP_RST);
+	ISP_OUT &= ~(1 << ISP_SCK);
+	ISP_DDR |= (1 << ISP_RST) | (1 << ISP_SCK) | (1 << ISP_MOSI);
+
+	if (ispTransmit == ispTransmit_hw) {
+		spiHWenable();
+	}
+}
+#endif
+
 void ispDisconnect() {
 
 	/* set all ISP pins inputs */
@@ -200,10 +238,11 @@ uchar ispTransmit_hw(uchar send_byte) {
 	return SPDR;
 }
 
-uchar ispEnterProgrammingMode() {
+static uchar ispEnterProgrammingModeATM() {
 	uchar check;
 	uchar count = 16;
 	chip=ATM;
+	ispSetSCKOption(isp_sck_option);
 	ispConnect();
 	while (count--) {
 		ispTransmit(0xAC);
@@ -230,14 +269,16 @@ uchar ispEnterProgrammingMode() {
 
 	}
 
-	count=16;
+	return 1; /* error: device dosn't answer */
+}
+
+static uchar ispEnterProgrammingModeS5x() {
+	uchar check;
+	uchar count = 16;
 	chip=S5x;
-	if(ispTransmit==ispTransmit_hw){
-	  spiHWdisable();
-	  //ispTransmit=ispTransmit_5x;
-	} 
-	ispTransmit = ispTransmit_sw;
-	sck_sw_delay = 2;
+	/* same SCK negotiation as AVR, SPI mode 0 fits AT89S too */
+	spiHWdisable();
+	ispSetSCKOption(isp_sck_option);
 	ispConnect();
 	while(count--){
 	  ispTransmit(0xAC);
@@ -247,16 +288,93 @@ uchar ispEnterProgrammingMode() {
 	  if(check==0x69){
 	    return 0;
 	  }    
+	  spiHWdisable();
+
 	  /* pulse SCK */
 	  ISP_OUT|=(1<<ISP_SCK);     /* SCK high */
 	  ispDelay();
 	  ISP_OUT&= ~(1<<ISP_SCK);    /* SCK low */
 	  ispDelay();  
+
+	  if (ispTransmit == ispTransmit_hw) {
+	    spiHWenable();
+	  }
 	}  
 
 	return 1; /* error: device dosn't answer */
 }
 
+uchar ispEnterProgrammingMode() {
+
+	/* try family of last successful connect first */
+	if (chip == S5x) {
+		if (ispEnterProgrammingModeS5x() == 0) {
+			return 0;
+		}
+		return ispEnterProgrammingModeATM();
+	}
+
+	if (ispEnterProgrammingModeATM() == 0) {
+		return 0;
+	}
+	return ispEnterProgrammingModeS5x();
+}
+
+/* echo mismatch: downshift SCK if link keeps failing */
+static void ispEchoError() {
+
+	isp_echo_failed = 1;
+	isp_echo_errors++;
+	if (isp_echo_errors >= ISP_ECHO_THRESHOLD
+			&& isp_sck_option > USBASP_ISP_SCK_0_5) {
+		ispSwitchSCKOption(isp_sck_option - 1);
+	}
+}
+
+/* send 4 byte instruction, return last received byte. if enabled by
+   profile, second byte must be echoed while third byte is sent (as
+   checked in ispEnterProgrammingMode), isp_echo_failed is set if not.
+   errors are forgotten again after 256 good instructions */
+static uchar ispInstruction(uchar b1, uchar b2, uchar b3, uchar b4) {
+
+	uchar echo, result;
+
+	isp_counters.instructions++;
+
+	ispTransmit(b1);
+	ispTransmit(b2);
+	echo = ispTransmit(b3);
+	result = ispTransmit(b4);
+
+	if ((ispTransmit == ispTransmit_hw) && (isp_profile.flags
+			& ISP_PROFILE_ECHO)) {
+		if (echo != b2) {
+			ispEchoError();
+		} else if (++isp_echo_good == 0 && isp_echo_errors) {
+			isp_echo_errors--;
+		}
+	}
+
+	return result;
+}
+
+/* read instruction, has no effect on target, so retry it on echo error.
+   isp_echo_failed stays set only if all retries fail */
+static uchar ispReadInstruction(uchar b1, uchar b2, uchar b3) {
+
+	uchar retries = ISP_ECHO_RETRIES;
+	uchar failed = isp_echo_failed;
+	uchar result;
+
+	do {
+		isp_echo_failed = 0;
+		result = ispInstruction(b1, b2, b3, 0);
+	} while (isp_echo_failed && --retries);
+
+	isp_echo_failed |= failed;
+	return result;
+}
+
 static void ispUpdateExtended(unsigned long address)
 {
 	uchar curr_hiaddr;
@@ -268,21 +386,74 @@ static void ispUpdateExtended(unsigned long address)
 	{
 		isp_hiaddr = curr_hiaddr;
 		/* Load Extended Address byte */
-		ispTransmit(0x4D);
-		ispTransmit(0x00);
-		ispTransmit(isp_hiaddr);
-		ispTransmit(0x00);
+		ispInstruction(0x4D, 0x00, isp_hiaddr, 0x00);
 	}
 }
 
+void ispSetProfile(const ispProfile *profile) {
+	isp_profile = *profile;
+	isp_profile.twd_flash = CLOCK_US_TO_TICKS(profile->twd_flash);
+	isp_profile.twd_eeprom = CLOCK_US_TO_TICKS(profile->twd_eeprom);
+	isp_profile.twd_erase = CLOCK_US_TO_TICKS(profile->twd_erase);
+}
+
+void ispResetProfile() {
+	isp_profile.flash_pagesize = 0;
+	isp_profile.eeprom_pagesize = 0;
+	isp_profile.flags = 0;
+	isp_profile.twd_flash = CLOCK_US_TO_TICKS(4800);
+	isp_profile.twd_eeprom = CLOCK_US_TO_TICKS(9600);
+	isp_profile.twd_erase = 0;
+}
+
+/* poll target until programming is finished, timeout is 2 * twd.
+   ATM: until flash differs from busyvalue, S5x: until it equals it */
+static uchar ispPollReady(unsigned long address, uchar busyvalue,
+		unsigned int twd) {
+
+	unsigned int elapsed = 0;
+	uint8_t lasttime = TIMERVALUE;
+	uint8_t now;
+	uchar check;
+
+	while (elapsed < 2 * twd) {
+		if (isp_profile.flags & ISP_PROFILE_RDYBSY) {
+			/* poll RDY/BSY */
+			if ((ispReadInstruction(0xF0, 0x00, 0x00) & 0x01) == 0) {
+				break;
+			}
+		} else {
+			/* poll flash */
+			check = ispReadFlash(address);
+			if ((chip == S5x) ? (check == busyvalue) : (check != busyvalue)) {
+				break;
+			}
+		}
+
+		isp_counters.poll_retries++;
+		now = TIMERVALUE;
+		elapsed += (uint8_t) (now - lasttime);
+		lasttime = now;
+	}
+
+	isp_poll_ticks = elapsed;
+	if (elapsed < 2 * twd) {
+		traceEvent(TRACE_POLL_EXIT, 0);
+		return 0;
+	}
+
+	isp_counters.poll_timeouts++;
+	traceEvent(TRACE_POLL_EXIT, 1);
+	return 1; /* error */
+}
+
 uchar ispReadFlash(unsigned long address) {
 
 	ispUpdateExtended(address);
 
 	if(chip==ATM){
-	ispTransmit(0x20 | ((address & 1) << 3));
-	ispTransmit(address >> 9);
-	ispTransmit(address >> 1);
+	return ispReadInstruction(0x20 | ((address & 1) << 3), address >> 9,
+			address >> 1);
 	} else {
 	  ispTransmit(0x20);
 	  ispTransmit(address>>8);
@@ -302,95 +473,178 @@ uchar ispWriteFlash(unsigned long address, uchar data, uchar pollmode) {
   if(chip==ATM){
 	ispUpdateExtended(address);
 
-	ispTransmit(0x40 | ((address & 1) << 3));
-	ispTransmit(address >> 9);
-	ispTransmit(address >> 1);
-	ispTransmit(data);
+	ispInstruction(0x40 | ((address & 1) << 3), address >> 9, address >> 1,
+			data);
 
 	if (pollmode == 0)
 		return 0;
 
-	if (data == 0x7F) {
-		clockWait(15); /* wait 4,8 ms */
+	if (data == 0x7F && !(isp_profile.flags & ISP_PROFILE_RDYBSY)) {
+		clockWaitTicks(isp_profile.twd_flash);
 		return 0;
 	} else {
-
-		/* polling flash */
-		uchar retries = 30;
-		uint8_t starttime = TIMERVALUE;
-		while (retries != 0) {
-			if (ispReadFlash(address) != 0x7F) {
-				return 0;
-			};
-
-			if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
-				starttime = TIMERVALUE;
-				retries--;
-			}
-
-		}
-		return 1; /* error */
+		return ispPollReady(address, 0x7F, isp_profile.twd_flash);
 	}
   } else {  
     ispTransmit(0x40);
     ispTransmit(address >> 8);
     ispTransmit(address);
     ispTransmit(data);
-    return 0;
+
+    /* at hardware SCK next byte may follow before write is done */
+    return ispPollReady(address, data, isp_profile.twd_flash);
 }
 }
 
 
 uchar ispFlushPage(unsigned long address, uchar pollvalue) {
 
+	uchar result = 0;
+
 	ispUpdateExtended(address);
+	traceEvent(TRACE_FLUSH_BEGIN, 0);
+
+	/* page buffer may hold words at wrong addresses, don't write it */
+	if (isp_echo_failed) {
+		traceEvent(TRACE_FLUSH_END, 1);
+		return 1;
+	}
 	
-	ispTransmit(0x4C);
-	ispTransmit(address >> 9);
-	ispTransmit(address >> 1);
-	ispTransmit(0);
+	ispInstruction(0x4C, address >> 9, address >> 1, 0);
+	isp_counters.flush_calls++;
 
-	if (pollvalue == 0xFF) {
-		clockWait(15);
-		return 0;
+	if (pollvalue == 0xFF && !(isp_profile.flags & ISP_PROFILE_RDYBSY)) {
+		clockWaitTicks(isp_profile.twd_flash);
+		isp_poll_ticks = isp_profile.twd_flash;
 	} else {
+		result = ispPollReady(address, 0xFF, isp_profile.twd_flash);
+	}
+	isp_counters.flush_ticks += isp_poll_ticks;
+	result |= isp_echo_failed;
+	traceEvent(TRACE_FLUSH_END, result);
 
-		/* polling flash */
-		uchar retries = 30;
-		uint8_t starttime = TIMERVALUE;
+	return result;
 
-		while (retries != 0) {
-			if (ispReadFlash(address) != 0xFF) {
-				return 0;
-			};
+}
 
-			if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
-				starttime = TIMERVALUE;
-				retries--;
-			}
+uchar ispReadEEPROM(unsigned int address) {
+	return ispReadInstruction(0xA0, address >> 8, address);
+}
 
-		}
+uchar ispWriteEEPROM(unsigned int address, uchar data) {
 
-		return 1; /* error */
+	ispInstruction(0xC0, address >> 8, address, data);
+
+	if (isp_profile.flags & ISP_PROFILE_RDYBSY) {
+		return ispPollReady(0, 0, isp_profile.twd_eeprom);
 	}
 
+	clockWaitTicks(isp_profile.twd_eeprom);
+
+	return 0;
 }
 
-uchar ispReadEEPROM(unsigned int address) {
-	ispTransmit(0xA0);
-	ispTransmit(address >> 8);
-	ispTransmit(address);
-	return ispTransmit(0);
+void ispLoadEEPROMPage(unsigned int address, uchar data) {
+	ispInstruction(0xC1, 0x00, address, data);
 }
 
-uchar ispWriteEEPROM(unsigned int address, uchar data) {
+uchar ispFlushEEPROMPage(unsigned int address) {
 
-	ispTransmit(0xC0);
-	ispTransmit(address >> 8);
-	ispTransmit(address);
-	ispTransmit(data);
+	if (isp_echo_failed) {
+		return 1;
+	}
+
+	ispInstruction(0xC2, address >> 8, address, 0x00);
+
+	if (isp_profile.flags & ISP_PROFILE_RDYBSY) {
+		return ispPollReady(0, 0, isp_profile.twd_eeprom);
+	}
 
-	clockWait(30); // wait 9,6 ms
+	clockWaitTicks(isp_profile.twd_eeprom);
 
 	return 0;
 }
+
+uchar ispWaitChipErase() {
+
+	if (isp_profile.twd_erase == 0) {
+		return 0;
+	}
+
+	if (isp_profile.flags & ISP_PROFILE_RDYBSY) {
+		return ispPollReady(0, 0, isp_profile.twd_erase);
+	}
+
+	clockWaitTicks(isp_profile.twd_erase);
+
+	return 0;
+}
+
+uchar ispReadFlashS5x(unsigned long address) {
+
+	if (isp_page_left != 0 && (isp_page_write || address != isp_page_next)) {
+		ispEndPageS5x();
+	}
+
+	/* reading ahead is harmless, rest of page is clocked out on end */
+	if (isp_page_left == 0 && (address & 0xFF) == 0) {
+		/* page mode read, 256 bytes follow header */
+		ispTransmit(0x30);
+		ispTransmit(address >> 8);
+		isp_page_left = 256;
+		isp_page_write = 0;
+	}
+
+	if (isp_page_left != 0) {
+		isp_page_left--;
+		isp_page_next = address + 1;
+		return ispTransmit(0);
+	}
+
+	return ispReadFlash(address);
+}
+
+uchar ispWriteFlashS5x(unsigned long address, uchar data, uchar pagemode) {
+
+	if (isp_page_left != 0 && (!isp_page_write || address != isp_page_next)) {
+		ispEndPageS5x();
+	}
+
+	if (isp_page_left == 0 && (address & 0xFF) == 0 && pagemode) {
+		/* page mode write, 256 bytes follow header */
+		ispTransmit(0x50);
+		ispTransmit(address >> 8);
+		isp_page_left = 256;
+		isp_page_write = 1;
+	}
+
+	if (isp_page_left != 0) {
+		ispTransmit(data);
+		isp_page_left--;
+		isp_page_next = address + 1;
+		if (isp_page_left == 0) {
+			/* page complete, poll last byte */
+			return ispPollReady(address, data, isp_profile.twd_flash);
+		}
+		return 0;
+	}
+
+	return ispWriteFlash(address, data, 1);
+}
+
+void ispEndPageS5x() {
+
+	if (isp_page_left == 0) {
+		return;
+	}
+
+	/* clock out rest of page, 0xFF leaves flash unchanged */
+	while (isp_page_left != 0) {
+		ispTransmit(0xFF);
+		isp_page_left--;
+	}
+
+	if (isp_page_write) {
+		clockWaitTicks(isp_profile.twd_flash);
+	}
+}
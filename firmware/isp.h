@@ -27,14 +27,61 @@
 #define ATM 0x00
 #define S5x 0xFF
 
+/* target family, the one of the last connect is tried first */
 unsigned char chip;
 
+/* SCK option in use */
+extern uchar isp_sck_option;
+
+/* part timing profile (see USBASP_FUNC_SETPROFILE) */
+typedef struct {
+	unsigned int flash_pagesize;	/* bytes, see ISP_PROFILE_PAGESIZE */
+	uchar eeprom_pagesize;		/* bytes, 0 = byte mode */
+	uchar flags;			/* ISP_PROFILE_* */
+	unsigned int twd_flash;		/* us as uploaded, timer ticks in use */
+	unsigned int twd_eeprom;
+	unsigned int twd_erase;		/* 0 = host waits after chip erase */
+} ispProfile;
+
+#define ISP_PROFILE_RDYBSY  0x01	/* target supports RDY/BSY polling */
+#define ISP_PROFILE_ECHO    0x02	/* check instruction echo at hardware SCK */
+#define ISP_PROFILE_PAGESIZE 0x04	/* flash_pagesize if request gives 0 */
+
+/* echo mismatches before SCK is lowered, retries per read instruction */
+#define ISP_ECHO_THRESHOLD  4
+#define ISP_ECHO_RETRIES    8
+
+/* set on echo mismatch of an instruction that changes the target, page
+ * flushes are refused then. cleared by caller before page or block */
+extern uchar isp_echo_failed;
+
+/* profile currently in use */
+extern ispProfile isp_profile;
+
+/* performance counters (see USBASP_FUNC_COUNTERS) */
+typedef struct {
+	unsigned long instructions;	/* 4 byte instructions issued */
+	unsigned int flush_calls;	/* ispFlushPage() calls */
+	unsigned long flush_ticks;	/* timer ticks (5.33 us) waiting in it */
+	unsigned int poll_retries;	/* extra polls until write was done */
+	unsigned int poll_timeouts;
+} ispCounters;
+
+extern ispCounters isp_counters;
+
 /* Prepare connection to target device */
 void ispConnect();
 
 /* Close connection to target device */
 void ispDisconnect();
 
+/* Prepare connection to generic SPI device, RST is chip select */
+void ispConnectSPI();
+
+/* chip select of generic SPI device */
+#define ispSelectSPI()    ISP_OUT &= ~(1 << ISP_RST)
+#define ispDeselectSPI()  ISP_OUT |= (1 << ISP_RST)
+
 /* read an write a byte from isp using software (slow) */
 uchar ispTransmit_sw(uchar send_byte);
 
@@ -55,6 +102,17 @@ uchar ispFlushPage(unsigned long address, uchar pollvalue);
 /* read byte from flash at given address */
 uchar ispReadFlash(unsigned long address);
 
+/* S5x: read byte from flash, page mode from page start on. page mode
+   continues over transfers as long as addresses follow on */
+uchar ispReadFlashS5x(unsigned long address);
+
+/* S5x: write byte to flash, page mode from page start on if pagemode is
+   set (a full page or further transfers follow) */
+uchar ispWriteFlashS5x(unsigned long address, uchar data, uchar pagemode);
+
+/* S5x: finish open page mode transfer, rest of page is padded */
+void ispEndPageS5x();
+
 /* write byte to eeprom at given address */
 uchar ispWriteEEPROM(unsigned int address, uchar data);
 
@@ -64,7 +122,25 @@ uchar (*ispTransmit)(uchar);
 /* set SCK speed. call before ispConnect! */
 void ispSetSCKOption(uchar sckoption);
 
+/* change SCK speed of established connection */
+void ispSwitchSCKOption(uchar sckoption);
+
 /* load extended address byte */
 void ispLoadExtendedAddressByte(unsigned long address);
 
+/* load byte to eeprom page buffer */
+void ispLoadEEPROMPage(unsigned int address, uchar data);
+
+/* write eeprom page buffer at given address */
+uchar ispFlushEEPROMPage(unsigned int address);
+
+/* wait for completion of chip erase as given by profile */
+uchar ispWaitChipErase();
+
+/* use given timing profile, times given in us */
+void ispSetProfile(const ispProfile *profile);
+
+/* restore worst-case timing profile */
+void ispResetProfile();
+
 #endif /* __isp_h_included__ */
@@ -0,0 +1,271 @@
+/*
+ * jtag.c - part of USBasp
+ *
+ * Description....: Provides functions for programming AVR devices over
+ *                  JTAG (TMS = RST, TDI = MOSI, TDO = MISO, TCK = SCK)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include <util/delay_basic.h>
+#include "isp.h"
+#include "clock.h"
+#include "jtag.h"
+
+#ifdef USBASP_JTAG
+
+#define JTAG_STATE_IDLE      0
+#define JTAG_STATE_PAGEREAD  1
+#define JTAG_STATE_PAGELOAD  2
+
+static uchar jtag_delay;
+static uchar jtag_state;
+
+static void jtagDelay() {
+	if (jtag_delay) {
+		_delay_loop_1(jtag_delay);
+	}
+}
+
+/* one TCK cycle, TDO changes after falling edge, sample it late in the
+ * low phase so a slower TCK gives the target more time */
+static uchar jtagClock(uchar tms, uchar tdi) {
+	uchar tdo;
+
+	if (tms) {
+		ISP_OUT |= (1 << JTAG_TMS);
+	} else {
+		ISP_OUT &= ~(1 << JTAG_TMS);
+	}
+	if (tdi) {
+		ISP_OUT |= (1 << JTAG_TDI);
+	} else {
+		ISP_OUT &= ~(1 << JTAG_TDI);
+	}
+	jtagDelay();
+	tdo = (ISP_IN >> JTAG_TDO) & 1;
+	ISP_OUT |= (1 << JTAG_TCK);
+	jtagDelay();
+	ISP_OUT &= ~(1 << JTAG_TCK);
+
+	return tdo;
+}
+
+/* shift bits LSB first, leave shift state with last bit */
+static unsigned long jtagShift(unsigned long data, uchar bits, uchar last) {
+	unsigned long out = 0;
+	uchar i;
+
+	for (i = 0; i < bits; i++) {
+		if (jtagClock(last && i == bits - 1, data & 1)) {
+			out |= 1UL << i;
+		}
+		data >>= 1;
+	}
+
+	return out;
+}
+
+/* Run-Test/Idle to Shift-DR */
+static void jtagShiftDR() {
+	jtagClock(1, 0);
+	jtagClock(0, 0);
+	jtagClock(0, 0);
+}
+
+/* Exit1 to Run-Test/Idle */
+static void jtagUpdate() {
+	jtagClock(1, 0);
+	jtagClock(0, 0);
+}
+
+static void jtagIR(uchar instruction) {
+	jtagClock(1, 0);
+	jtagShiftDR();
+	jtagShift(instruction, 4, 1);
+	jtagUpdate();
+}
+
+static unsigned long jtagDR(unsigned long data, uchar bits) {
+	unsigned long out;
+
+	jtagShiftDR();
+	out = jtagShift(data, bits, 1);
+	jtagUpdate();
+
+	return out;
+}
+
+/* abort page access left open in Shift-DR */
+static void jtagEndPage() {
+	if (jtag_state != JTAG_STATE_IDLE) {
+		jtagClock(1, 0);
+		jtagUpdate();
+		jtagIR(JTAG_PROG_COMMANDS);
+		jtag_state = JTAG_STATE_IDLE;
+	}
+}
+
+static void jtagLoadAddress(unsigned long address) {
+	/* flash is word addressed */
+	address >>= 1;
+	if (address >> 16) {
+		jtagDR(JTAG_CMD_ADDR_EXT | ((address >> 16) & 0xFF), 15);
+	}
+	jtagDR(JTAG_CMD_ADDR_HIGH | ((address >> 8) & 0xFF), 15);
+	jtagDR(JTAG_CMD_ADDR_LOW | (address & 0xFF), 15);
+}
+
+unsigned long jtagConnect(uchar delay) {
+	unsigned long idcode;
+	uchar i;
+
+	jtag_delay = delay;
+	jtag_state = JTAG_STATE_IDLE;
+
+	/* no hardware SPI, TDO input */
+	SPCR = 0;
+	ISP_DDR &= ~(1 << JTAG_TDO);
+	ISP_OUT &= ~((1 << JTAG_TCK) | (1 << JTAG_TDI));
+	ISP_OUT |= (1 << JTAG_TMS);
+	ISP_DDR |= (1 << JTAG_TMS) | (1 << JTAG_TDI) | (1 << JTAG_TCK);
+
+	/* Test-Logic-Reset, then Run-Test/Idle */
+	for (i = 0; i < 5; i++) {
+		jtagClock(1, 0);
+	}
+	jtagClock(0, 0);
+
+	jtagIR(JTAG_IDCODE);
+	idcode = jtagDR(0, 32);
+
+	jtagIR(JTAG_AVR_RESET);
+	jtagDR(1, 1);
+	jtagIR(JTAG_PROG_ENABLE);
+	jtagDR(JTAG_PROG_SIGNATURE, 16);
+	jtagIR(JTAG_PROG_COMMANDS);
+
+	return idcode;
+}
+
+void jtagDisconnect() {
+
+	jtagEndPage();
+	jtagIR(JTAG_PROG_COMMANDS);
+	jtagDR(JTAG_CMD_LEAVE, 15);
+	jtagDR(JTAG_CMD_NOP, 15);
+	jtagIR(JTAG_PROG_ENABLE);
+	jtagDR(0, 16);
+	jtagIR(JTAG_AVR_RESET);
+	jtagDR(0, 1);
+
+	/* Test-Logic-Reset */
+	jtagClock(1, 0);
+	jtagClock(1, 0);
+	jtagClock(1, 0);
+
+	ISP_DDR &= ~((1 << JTAG_TMS) | (1 << JTAG_TDI) | (1 << JTAG_TCK));
+	ISP_OUT &= ~((1 << JTAG_TMS) | (1 << JTAG_TDI) | (1 << JTAG_TCK));
+}
+
+unsigned int jtagCommand(unsigned int command, uchar poll) {
+	uchar timeout = JTAG_T_POLL;
+	uint8_t starttime = TIMERVALUE;
+	unsigned int out;
+
+	jtagEndPage();
+
+	for (;;) {
+		out = jtagDR(command, 15);
+		if (!poll || (out & JTAG_CMD_POLL_BIT)) {
+			return out;
+		}
+
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			if (--timeout == 0) {
+				return out; /* error */
+			}
+		}
+	}
+}
+
+uchar jtagReadFlash(unsigned long address, unsigned int pagesize,
+		uchar last) {
+	unsigned int offset = address & (pagesize - 1);
+	uchar data;
+
+	if (jtag_state != JTAG_STATE_PAGEREAD || offset == 0) {
+		jtagEndPage();
+		jtagDR(JTAG_CMD_ENTER_READ, 15);
+		jtagLoadAddress(address - offset);
+		jtagIR(JTAG_PROG_PAGEREAD);
+		jtagShiftDR();
+
+		/* first byte out is not valid, skip to address */
+		jtagShift(0, 8, 0);
+		while (offset--) {
+			jtagShift(0, 8, 0);
+		}
+		jtag_state = JTAG_STATE_PAGEREAD;
+	}
+
+	/* page ends or transfer ends */
+	last = last || ((address + 1) & (pagesize - 1)) == 0;
+	data = jtagShift(0, 8, last);
+	if (last) {
+		jtagUpdate();
+		jtag_state = JTAG_STATE_IDLE;
+		jtagIR(JTAG_PROG_COMMANDS);
+	}
+
+	return data;
+}
+
+uchar jtagWriteFlash(unsigned long address, unsigned int pagesize,
+		uchar data, uchar last) {
+	unsigned int offset = address & (pagesize - 1);
+	uchar pageend;
+
+	/* 0xFF leaves flash unchanged, so partial pages are padded with it */
+	if (jtag_state != JTAG_STATE_PAGELOAD) {
+		jtagEndPage();
+		jtagDR(JTAG_CMD_ENTER_WRITE, 15);
+		jtagLoadAddress(address - offset);
+		jtagIR(JTAG_PROG_PAGELOAD);
+		jtagShiftDR();
+		while (offset--) {
+			jtagShift(0xFF, 8, 0);
+		}
+		jtag_state = JTAG_STATE_PAGELOAD;
+	}
+
+	pageend = ((address + 1) & (pagesize - 1)) == 0;
+	jtagShift(data, 8, pageend);
+	if (!pageend) {
+		if (!last) {
+			return 0;
+		}
+		do {
+			address++;
+			pageend = ((address + 1) & (pagesize - 1)) == 0;
+			jtagShift(0xFF, 8, pageend);
+		} while (!pageend);
+	}
+
+	jtagUpdate();
+	jtag_state = JTAG_STATE_IDLE;
+
+	/* write page and wait */
+	jtagIR(JTAG_PROG_COMMANDS);
+	jtagDR(JTAG_CMD_WRITE_PAGE1, 15);
+	jtagDR(JTAG_CMD_WRITE_PAGE2, 15);
+	jtagDR(JTAG_CMD_WRITE_PAGE1, 15);
+	jtagDR(JTAG_CMD_WRITE_PAGE1, 15);
+
+	return !(jtagCommand(JTAG_CMD_WRITE_PAGE1, 1) & JTAG_CMD_POLL_BIT);
+}
+
+#endif
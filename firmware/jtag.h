@@ -0,0 +1,66 @@
+/*
+ * jtag.h - part of USBasp
+ *
+ * Description....: Provides functions for programming AVR devices over
+ *                  JTAG (TMS = RST, TDI = MOSI, TDO = MISO, TCK = SCK)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __jtag_h_included__
+#define	__jtag_h_included__
+
+#define JTAG_TMS  ISP_RST
+#define JTAG_TDI  ISP_MOSI
+#define JTAG_TDO  ISP_MISO
+#define JTAG_TCK  ISP_SCK
+
+/* JTAG instructions */
+#define JTAG_IDCODE          0x1
+#define JTAG_PROG_ENABLE     0x4
+#define JTAG_PROG_COMMANDS   0x5
+#define JTAG_PROG_PAGELOAD   0x6
+#define JTAG_PROG_PAGEREAD   0x7
+#define JTAG_AVR_RESET       0xC
+#define JTAG_BYPASS          0xF
+
+#define JTAG_PROG_SIGNATURE  0xA370
+
+/* programming commands (15 bit) */
+#define JTAG_CMD_NOP             0x3300
+#define JTAG_CMD_LEAVE           0x2300
+#define JTAG_CMD_ENTER_WRITE     0x2310
+#define JTAG_CMD_ENTER_READ      0x2302
+#define JTAG_CMD_ADDR_EXT        0x0B00
+#define JTAG_CMD_ADDR_HIGH       0x0700
+#define JTAG_CMD_ADDR_LOW        0x0300
+#define JTAG_CMD_WRITE_PAGE1     0x3700
+#define JTAG_CMD_WRITE_PAGE2     0x3500
+#define JTAG_CMD_POLL_BIT        0x0200
+
+/* timeouts in 320 us units */
+#define JTAG_T_POLL          64
+
+/* Reset TAP, enter programming mode, delay is half TCK in 3 cycle units.
+ * Returns IDCODE */
+unsigned long jtagConnect(uchar delay);
+
+/* Leave programming mode and release pins */
+void jtagDisconnect();
+
+/* Shift programming command, repeat until poll bit is set if poll.
+ * Returns last output */
+unsigned int jtagCommand(unsigned int command, uchar poll);
+
+/* Read flash byte, pages are read with PROG_PAGEREAD as a whole */
+uchar jtagReadFlash(unsigned long address, unsigned int pagesize,
+		uchar last);
+
+/* Write flash byte into page buffer, page is written when full or last.
+ * Bytes of the page outside the transfer are loaded as 0xFF.
+ * Returns 0 on success */
+uchar jtagWriteFlash(unsigned long address, unsigned int pagesize,
+		uchar data, uchar last);
+
+#endif /* __jtag_h_included__ */
@@ -17,6 +17,8 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <avr/wdt.h>
+#include <avr/eeprom.h>
+#include <string.h>
 
 #include "usbasp.h"
 #include "usbdrv.h"
@@ -24,28 +26,484 @@
 #include "clock.h"
 #include "tpi.h"
 #include "tpi_defs.h"
+#include "spiflash.h"
+#include "i2c.h"
+#include "uart.h"
+#include "pdi.h"
+#include "updi.h"
+#include "jtag.h"
+#include "dw.h"
+#include "capture.h"
+#include "trace.h"
 
 static uchar replyBuffer[8];
 
 static uchar prog_state = PROG_STATE_IDLE;
+static uchar prog_mode = PROG_MODE_ISP;
 static uchar prog_sck = USBASP_ISP_SCK_AUTO;
+static uchar prog_sck_stored;	/* session uses SCK of prog_settings */
 
 static uchar prog_address_newmode = 0;
 static unsigned long prog_address;
 static unsigned int prog_nbytes = 0;
 static unsigned int prog_pagesize;
 static uchar prog_blockflags;
+static uchar prog_memtype;
+static unsigned long prog_pageaddress;
 static uchar prog_pagecounter;
+static ispProfile prog_profile;
+
+/* programmer settings, persisted in own EEPROM */
+typedef struct {
+	uchar magic;
+	uchar flags;		/* PROG_SETTINGS_* */
+	uchar chip;		/* target family of last connect */
+	uchar sck;		/* SCK option used for USBASP_ISP_SCK_AUTO */
+	ispProfile profile;	/* as uploaded, times in us */
+} progSettings;
+
+#define PROG_SETTINGS_MAGIC 0x5A
+
+static progSettings prog_settings;
+static progSettings EEMEM eeprom_settings;
+
+#ifdef USBASP_MACRO
+/* uploaded ISP macros (see USBASP_FUNC_MACRO_STORE) */
+static uchar EEMEM eeprom_macros[ISP_MACRO_SLOTS][ISP_MACRO_SIZE];
+static uchar prog_macro_slot;
+#endif
+
+/* data of raw transfers: TPI sequence, SPI bridge */
+static uchar prog_buffer[PROG_BUFFER_SIZE];
+static uchar prog_buffer_len;
+#ifdef USBASP_SPI
+static uchar prog_spi_flags;
+#endif
+
+/* received bytes of TPI sequence (see USBASP_FUNC_TPI_SCRIPT) */
+static uchar tpi_script_result[TPI_SCRIPT_RESULT_SIZE];
+static uchar tpi_script_nresult;
+
+/* performance counters, returned and reset by USBASP_FUNC_COUNTERS */
+typedef struct {
+	unsigned long read_bytes[PROG_COUNT_TYPES];	/* as transferred */
+	unsigned long write_bytes[PROG_COUNT_TYPES];
+	ispCounters isp;
+	unsigned int tpi_recv_timeouts;
+	unsigned int write_blocking;	/* packets waiting for target writes */
+} progCounters;
+
+static progCounters prog_counters;
+static uchar prog_count_type;	/* memory type of current transfer */
+
+#ifdef USBASP_DW
+/* pending debugWIRE operation (see USBASP_FUNC_DW_READ) */
+static uchar prog_dw_op = PROG_DW_NONE;
+static uchar prog_dw_len;
+static uchar prog_dw_eecr;
+
+/* transmit state of driver, status stage is done when idle */
+extern volatile uchar usbTxLen;
+#endif
+
+/* ISP instructions of the identification bundle (see USBASP_FUNC_IDENTIFY) */
+static const uchar ispIdentifyInstructions[8][4] PROGMEM = {
+	{ 0x30, 0x00, 0x00, 0x00 },	/* signature byte 0 */
+	{ 0x30, 0x00, 0x01, 0x00 },	/* signature byte 1 */
+	{ 0x30, 0x00, 0x02, 0x00 },	/* signature byte 2 */
+	{ 0x50, 0x00, 0x00, 0x00 },	/* low fuse */
+	{ 0x58, 0x08, 0x00, 0x00 },	/* high fuse */
+	{ 0x50, 0x08, 0x00, 0x00 },	/* extended fuse */
+	{ 0x58, 0x00, 0x00, 0x00 },	/* lock bits */
+	{ 0x38, 0x00, 0x00, 0x00 }	/* calibration byte */
+};
+
+/* send one 4 byte ISP instruction, translate it for S5x targets */
+static void ispTransmitInstruction(uchar *cmd, uchar *result) {
+
+	isp_counters.instructions++;
+
+	if (chip == S5x && cmd[0] == 0x24) {
+		/* read lock bits */
+		result[0] = ispTransmit(cmd[0]);
+		result[1] = ispTransmit(cmd[1]);
+		result[2] = ispTransmit(cmd[2]);
+		switch (ispTransmit(cmd[3]) & 0x1C) {
+		case (0x00): result[3] = 0xE0; break;
+		case (0x04): result[3] = 0xE5; break;
+		case (0x0C): result[3] = 0xEE; break;
+		case (0x1C): result[3] = 0xFF; break;
+		}
+		return;
+	}
+
+	if (chip == S5x && cmd[0] == 0x30) {
+		/* read signature */
+		result[0] = ispTransmit(0x28);
+	} else {
+		result[0] = ispTransmit(cmd[0]);
+	}
+	result[1] = ispTransmit(cmd[1]);
+	result[2] = ispTransmit(cmd[2]);
+	result[3] = ispTransmit(cmd[3]);
+}
+
+/* read signature, fuses, lock and calibration byte of ISP target */
+static void ispIdentify(uchar *result) {
+	uchar cmd[4];
+	uchar reply[4];
+	uchar i, j;
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 4; j++) {
+			cmd[j] = pgm_read_byte(&ispIdentifyInstructions[i][j]);
+		}
+
+		if (chip == S5x) {
+			/* S5x: signature address in second byte, no fuses/calibration */
+			if (i < 3) {
+				cmd[1] = i;
+				cmd[2] = 0;
+			} else if (i == 6) {
+				cmd[0] = 0x24;
+			} else {
+				result[i] = 0xFF;
+				continue;
+			}
+		}
+
+		reply[3] = 0xFF;
+		ispTransmitInstruction(cmd, reply);
+		result[i] = reply[3];
+	}
+}
+
+/* read signature, config, lock and calibration byte of TPI target */
+static void tpiIdentify(uchar *result) {
+	tpi_read_block(TPI_SIGNATURE_ADDR, &result[0], 3);
+	tpi_read_block(TPI_CONFIG_ADDR, &result[3], 1);
+	result[4] = 0xFF;
+	result[5] = 0xFF;
+	tpi_read_block(TPI_LOCK_ADDR, &result[6], 1);
+	tpi_read_block(TPI_CALIB_ADDR, &result[7], 1);
+}
+
+static void settingsSave() {
+	prog_settings.magic = PROG_SETTINGS_MAGIC;
+	eeprom_update_block(&prog_settings, &eeprom_settings,
+			sizeof(prog_settings));
+}
+
+static void settingsClear() {
+	prog_settings.flags = 0;
+	chip = ATM;
+	eeprom_update_byte(&eeprom_settings.magic, 0xFF);
+}
+
+/* page sizes are used as address masks, must be powers of two */
+static uchar profileValid(ispProfile *profile) {
+	unsigned int flash = profile->flash_pagesize;
+	uchar eeprom = profile->eeprom_pagesize;
+
+	return !(flash & (flash - 1)) && !(eeprom & (eeprom - 1));
+}
+
+static void settingsLoad() {
+	eeprom_read_block(&prog_settings, &eeprom_settings, sizeof(prog_settings));
+	if (prog_settings.magic != PROG_SETTINGS_MAGIC) {
+		prog_settings.flags = 0;
+	}
+	if (!profileValid(&prog_settings.profile)) {
+		prog_settings.flags &= ~PROG_SETTINGS_PROFILE;
+	}
+}
+
+/* remember target family and SCK of successful connect */
+static void settingsStoreTarget(uchar family, uchar sck) {
+	if (!(prog_settings.flags & PROG_SETTINGS_TARGET) || (prog_settings.chip
+			!= family) || (prog_settings.sck != sck)) {
+		prog_settings.flags |= PROG_SETTINGS_TARGET;
+		prog_settings.chip = family;
+		prog_settings.sck = sck;
+		settingsSave();
+	}
+}
+
+/* program shortest guard time target answers reliably with */
+static uchar tpiNegotiateGuardTime() {
+	uchar gt;
+
+	for (gt = TPIPCR_GT_0b; gt != TPIPCR_GT_128b; gt--) {
+		tpi_send_byte(TPI_OP_SSTCS(TPIPCR));
+		tpi_send_byte(gt);
+		tpi_recv_timeout = TPI_RECV_TIMEOUT(gt);
+
+		/* read back twice with new guard time */
+		tpi_send_byte(TPI_OP_SLDCS(TPIPCR));
+		if ((tpi_recv_byte() & 0x07) == gt) {
+			tpi_send_byte(TPI_OP_SLDCS(TPIPCR));
+			if ((tpi_recv_byte() & 0x07) == gt) {
+				return gt;
+			}
+		}
+	}
+
+	/* fall back to default */
+	tpi_recv_timeout = TPI_RECV_TIMEOUT_DEFAULT;
+	tpi_send_byte(TPI_OP_SSTCS(TPIPCR));
+	tpi_send_byte(TPIPCR_GT_128b);
+	return TPIPCR_GT_128b;
+}
+
+/* check TPI sequence before running it: known operations, complete
+ * SEND data, received bytes fit into tpi_script_result */
+static uchar tpiCheckScript(uchar len) {
+	uchar i = 0;
+	uchar op, nresult = 0;
+
+	while (i < len) {
+		op = prog_buffer[i++];
+		switch (op & ~TPI_SCRIPT_COUNT) {
+		case TPI_SCRIPT_SEND:
+			i += op & TPI_SCRIPT_COUNT;
+			if (i > len) {
+				return 1;
+			}
+			break;
+		case TPI_SCRIPT_RECV:
+			nresult += op & TPI_SCRIPT_COUNT;
+			if (nresult > TPI_SCRIPT_RESULT_SIZE) {
+				return 1;
+			}
+			break;
+		case TPI_SCRIPT_NVMWAIT:
+			break;
+		default:
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* run TPI sequence checked by tpiCheckScript, received bytes are stored
+ * to tpi_script_result, result: 0 or NVMWAIT status */
+static uchar tpiRunScript(uchar len) {
+	uchar i = 0;
+	uchar op, n, status;
+
+	tpi_script_nresult = 0;
+
+	while (i < len) {
+		op = prog_buffer[i++];
+		n = op & TPI_SCRIPT_COUNT;
+
+		switch (op & ~TPI_SCRIPT_COUNT) {
+		case TPI_SCRIPT_SEND:
+			while (n--) {
+				tpi_send_byte(prog_buffer[i++]);
+			}
+			break;
+		case TPI_SCRIPT_RECV:
+			while (n--) {
+				tpi_script_result[tpi_script_nresult++] = tpi_recv_byte();
+			}
+			break;
+		case TPI_SCRIPT_NVMWAIT:
+			/* count is timeout in 1.28 ms units */
+			status = tpi_nvm_wait(n ? n << 2 : TPI_NVM_TIMEOUT);
+			if (status != TPI_NVM_READY) {
+				return status;
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+#ifdef USBASP_MACRO
+/* run ISP macro from prog_buffer, result: status, stop position and
+ * last answer */
+static void ispRunMacro(uchar *result) {
+	uchar i = 0;
+	uchar op, timeout;
+	uint8_t starttime;
+	uchar *answer = &result[2];
+	uchar *operand;
+
+	result[0] = ISP_MACRO_OK;
+	answer[0] = answer[1] = answer[2] = answer[3] = 0;
+
+	while (i < ISP_MACRO_SIZE) {
+		result[1] = i;
+		op = prog_buffer[i++];
+		operand = &prog_buffer[i];
+
+		switch (op) {
+		case ISP_MACRO_END:
+			return;
+		case ISP_MACRO_SEND:
+			ispTransmitInstruction(operand, answer);
+			i += 4;
+			break;
+		case ISP_MACRO_EXPECT:
+			if ((answer[operand[0] & 3] & operand[1]) != operand[2]) {
+				result[0] = ISP_MACRO_MISMATCH;
+				return;
+			}
+			i += 3;
+			break;
+		case ISP_MACRO_POLL:
+			/* repeat instruction until answer matches */
+			timeout = operand[7];
+			starttime = TIMERVALUE;
+			for (;;) {
+				ispTransmitInstruction(operand, answer);
+				if ((answer[operand[4] & 3] & operand[5]) == operand[6]) {
+					break;
+				}
+				if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+					starttime = TIMERVALUE;
+					if (timeout-- == 0) {
+						result[0] = ISP_MACRO_TIMEOUT;
+						return;
+					}
+				}
+			}
+			i += 8;
+			break;
+		case ISP_MACRO_WAIT:
+			clockWait(operand[0]);
+			i += 1;
+			break;
+		case ISP_MACRO_RST:
+			if (operand[0]) {
+				ISP_OUT |= (1 << ISP_RST);
+			} else {
+				ISP_OUT &= ~(1 << ISP_RST);
+			}
+			i += 1;
+			break;
+		case ISP_MACRO_SCK:
+			ispSwitchSCKOption(operand[0]);
+			i += 1;
+			break;
+		default:
+			result[0] = ISP_MACRO_INVALID;
+			return;
+		}
+	}
+}
+#endif
+
+/* run NVM command by storing len bytes from addr on, wait until done,
+ * result: TPI_NVM_READY, TPI_NVM_BUSY or TPI_NVM_NORESPONSE */
+static uchar tpiNvmOperation(uchar cmd, unsigned int addr, uchar *data,
+		uchar len) {
+
+	tpi_send_byte(TPI_OP_SOUT(NVMCMD));
+	tpi_send_byte(cmd);
+
+	tpi_send_byte(TPI_OP_SSTPR(0));
+	tpi_send_byte(addr);
+	tpi_send_byte(TPI_OP_SSTPR(1));
+	tpi_send_byte(addr >> 8);
+	tpi_pr_valid = 0;
+
+	while (len--) {
+		tpi_send_byte(TPI_OP_SST_INC);
+		tpi_send_byte(*data++);
+	}
+
+	return tpi_nvm_wait(TPI_NVM_TIMEOUT);
+}
+
+/* select byte counter of multi packet transfer started by setup */
+static void countTransfer() {
+	uchar type = PROG_COUNT_OTHER;
+
+	if (prog_state == PROG_STATE_READFLASH
+			|| prog_state == PROG_STATE_WRITEFLASH
+			|| prog_state == PROG_STATE_JTAG_READ
+			|| prog_state == PROG_STATE_JTAG_WRITE) {
+		type = PROG_COUNT_FLASH;
+	} else if (prog_state == PROG_STATE_READEEPROM
+			|| prog_state == PROG_STATE_WRITEEEPROM) {
+		type = PROG_COUNT_EEPROM;
+	}
+
+	prog_count_type = type;
+}
+
+#ifdef USBASP_DW
+/* queue debugWIRE operation, status in prog_buffer[0] until it is run */
+static void dwQueue(uchar op) {
+
+	prog_buffer[0] = USBASP_DW_PENDING;
+	prog_buffer_len = 1;
+	prog_dw_op = op;
+}
+
+/* run debugWIRE operation requested by last setup, status and results are
+ * fetched with USBASP_FUNC_DW_RESULT */
+static void dwRunPending() {
+	uchar len = 0;
+
+	prog_buffer[0] = USBASP_DW_ERROR;
+	if (prog_dw_op == PROG_DW_CONNECT) {
+		len = dwConnect(&prog_buffer[1]);
+	} else if (prog_dw_op == PROG_DW_READ) {
+		if (dwRead(prog_memtype, prog_address, &prog_buffer[1], prog_dw_len,
+				prog_dw_eecr) == 0) {
+			len = prog_dw_len;
+		}
+	} else if (prog_dw_op == PROG_DW_DISABLE) {
+		dwDisable();
+		prog_mode = PROG_MODE_ISP;
+		prog_buffer[0] = USBASP_DW_OK;
+	}
+
+	if (len) {
+		prog_buffer[0] = USBASP_DW_OK;
+	}
+	prog_buffer_len = 1 + len;
+	prog_dw_op = PROG_DW_NONE;
+}
+#endif
 
 uchar usbFunctionSetup(uchar data[8]) {
 
 	uchar len = 0;
 
+	usbMsgPtr = replyBuffer;
+	traceRequest(data[1]);
+
+	/* new request, S5x page mode transfer stays open only for flash
+	 * accesses, which close it themselves if addresses don't follow on */
+	if (data[1] != USBASP_FUNC_READFLASH && data[1] != USBASP_FUNC_WRITEFLASH) {
+		ispEndPageS5x();
+	}
+
+#ifdef USBASP_SPIFLASH
+	/* transfer abandoned by host, release chip select */
+	if (prog_state == PROG_STATE_SPIFLASH_READ) {
+		spiflashReadEnd();
+		prog_state = PROG_STATE_IDLE;
+	} else if (prog_state == PROG_STATE_SPIFLASH_WRITE) {
+		spiflashWriteEnd();
+		prog_state = PROG_STATE_IDLE;
+	}
+#endif
+
 	if (data[1] == USBASP_FUNC_CONNECT) {
 
 		/* set SCK speed */
+		prog_sck_stored = 0;
 		if ((PINC & (1 << PC2)) == 0) {
 			ispSetSCKOption(USBASP_ISP_SCK_8);
+		} else if ((prog_sck == USBASP_ISP_SCK_AUTO) && (prog_settings.flags
+				& PROG_SETTINGS_TARGET)) {
+			ispSetSCKOption(prog_settings.sck);
+			prog_sck_stored = 1;
 		} else {
 			ispSetSCKOption(prog_sck);
 		}
@@ -53,44 +511,49 @@ uchar usbFunctionSetup(uchar data[8]) {
 		/* set compatibility mode of address delivering */
 		prog_address_newmode = 0;
 
+		prog_mode = PROG_MODE_ISP;
+
+		/* stored or worst-case timing until host uploads a profile */
+		if (prog_settings.flags & PROG_SETTINGS_PROFILE) {
+			ispSetProfile(&prog_settings.profile);
+		} else {
+			ispResetProfile();
+		}
+
 		ledRedOn();
 		ispConnect();
 
 	} else if (data[1] == USBASP_FUNC_DISCONNECT) {
+#ifdef USBASP_UART
+		if (prog_mode == PROG_MODE_UART) {
+			uartDisconnect();
+		}
+#endif
+#ifdef USBASP_PDI
+		if (prog_mode == PROG_MODE_PDI) {
+			pdiDisconnect();
+		}
+#endif
+#ifdef USBASP_UPDI
+		if (prog_mode == PROG_MODE_UPDI) {
+			updiDisconnect();
+		}
+#endif
+#ifdef USBASP_JTAG
+		if (prog_mode == PROG_MODE_JTAG) {
+			jtagDisconnect();
+		}
+#endif
+		prog_mode = PROG_MODE_ISP;
 		ispDisconnect();
 		ledRedOff();
 
 	} else if (data[1] == USBASP_FUNC_TRANSMIT) {
-	  if(chip==ATM){
-		replyBuffer[0] = ispTransmit(data[2]);
-		replyBuffer[1] = ispTransmit(data[3]);
-		replyBuffer[2] = ispTransmit(data[4]);
-		replyBuffer[3] = ispTransmit(data[5]);
-	  } else {
-	    if(data[2]==0x24) {
-	      // read lock bits
-	      replyBuffer[0] = ispTransmit(data[2]);
-	      replyBuffer[1] = ispTransmit(data[3]);
-	      replyBuffer[2] = ispTransmit(data[4]);
-	      switch(ispTransmit(data[5])&0x1C) {
-	      case(0x00):replyBuffer[3]=0xE0;break;
-	      case(0x04):replyBuffer[3]=0xE5;break;
-	      case(0x0C):replyBuffer[3]=0xEE;break;
-	      case(0x1C):replyBuffer[3]=0xFF;break;
-	      }
-	    } else if(data[2]==0x30) {
-	      // read signature
-	      replyBuffer[0] = ispTransmit(0x28);
-	      replyBuffer[1] = ispTransmit(data[3]);
-	      replyBuffer[2] = ispTransmit(data[4]);
-	      replyBuffer[3] = ispTransmit(data[5]);
-	    } else {
-	      replyBuffer[0] = ispTransmit(data[2]);
-	      replyBuffer[1] = ispTransmit(data[3]);
-	      replyBuffer[2] = ispTransmit(data[4]);
-	      replyBuffer[3] = ispTransmit(data[5]);
-	    }
-	  }
+		ispTransmitInstruction(&data[2], replyBuffer);
+		if (chip == ATM && data[2] == 0xAC && data[3] == 0x80) {
+			/* chip erase */
+			ispWaitChipErase();
+		}
 		len = 4;
 
 	} else if (data[1] == USBASP_FUNC_READFLASH) {
@@ -100,6 +563,7 @@ uchar usbFunctionSetup(uchar data[8]) {
 
 		prog_nbytes = (data[7] << 8) | data[6];
 		prog_state = PROG_STATE_READFLASH;
+		isp_echo_failed = 0;
 		len = 0xff; /* multiple in */
 
 	} else if (data[1] == USBASP_FUNC_READEEPROM) {
@@ -109,10 +573,27 @@ uchar usbFunctionSetup(uchar data[8]) {
 
 		prog_nbytes = (data[7] << 8) | data[6];
 		prog_state = PROG_STATE_READEEPROM;
+		isp_echo_failed = 0;
 		len = 0xff; /* multiple in */
 
 	} else if (data[1] == USBASP_FUNC_ENABLEPROG) {
 		replyBuffer[0] = ispEnterProgrammingMode();
+		if (replyBuffer[0] != 0 && prog_sck_stored) {
+			/* stored SCK may not suit this target, try default */
+			prog_sck_stored = 0;
+			ispSetSCKOption(USBASP_ISP_SCK_AUTO);
+			replyBuffer[0] = ispEnterProgrammingMode();
+		}
+		if (replyBuffer[0] == 0) {
+			if ((PINC & (1 << PC2)) == 0) {
+				/* SCK forced by jumper, keep stored one */
+				settingsStoreTarget(chip, (prog_settings.flags
+						& PROG_SETTINGS_TARGET) ? prog_settings.sck
+						: USBASP_ISP_SCK_AUTO);
+			} else {
+				settingsStoreTarget(chip, isp_sck_option);
+			}
+		}
 		len = 1;
 
 	} else if (data[1] == USBASP_FUNC_WRITEFLASH) {
@@ -120,57 +601,617 @@ uchar usbFunctionSetup(uchar data[8]) {
 		if (!prog_address_newmode)
 			prog_address = (data[3] << 8) | data[2];
 
-		prog_pagesize = data[4];
-		prog_blockflags = data[5] & 0x0F;
-		prog_pagesize += (((unsigned int) data[5] & 0xF0) << 4);
-		if (prog_blockflags & PROG_BLOCKFLAG_FIRST) {
-			prog_pagecounter = prog_pagesize;
+		prog_pagesize = data[4];
+		prog_blockflags = data[5] & 0x0F;
+		prog_pagesize += (((unsigned int) data[5] & 0xF0) << 4);
+		if (prog_pagesize == 0
+				&& (isp_profile.flags & ISP_PROFILE_PAGESIZE)) {
+			prog_pagesize = isp_profile.flash_pagesize;
+		}
+		if (prog_blockflags & PROG_BLOCKFLAG_FIRST) {
+			/* echo errors are kept until the page is written */
+			prog_pagecounter = prog_pagesize;
+			isp_echo_failed = 0;
+		}
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_WRITEFLASH;
+		len = 0xff; /* multiple out */
+
+	} else if (data[1] == USBASP_FUNC_WRITEEEPROM) {
+
+		if (!prog_address_newmode)
+			prog_address = (data[3] << 8) | data[2];
+
+		prog_pagesize = 0;
+		prog_blockflags = 0;
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_WRITEEEPROM;
+		isp_echo_failed = 0;
+		len = 0xff; /* multiple out */
+
+	} else if (data[1] == USBASP_FUNC_SETLONGADDRESS) {
+
+		/* set new mode of address delivering (ignore address delivered in commands) */
+		prog_address_newmode = 1;
+		/* set new address */
+		prog_address = *((unsigned long*) &data[2]);
+
+	} else if (data[1] == USBASP_FUNC_SETISPSCK) {
+
+		/* set sck option */
+		prog_sck = data[2];
+		replyBuffer[0] = 0;
+		len = 1;
+
+	} else if (data[1] == USBASP_FUNC_SWITCHISPSCK) {
+
+		/* set sck option and apply it to running session, slow SCK
+		 * jumper overrides it as in connect */
+		prog_sck = data[2];
+		if (prog_mode == PROG_MODE_ISP || prog_mode == PROG_MODE_SPI) {
+			if ((PINC & (1 << PC2)) == 0) {
+				ispSwitchSCKOption(USBASP_ISP_SCK_8);
+			} else {
+				ispSwitchSCKOption(prog_sck);
+			}
+		}
+		replyBuffer[0] = 0;
+		len = 1;
+
+	} else if (data[1] == USBASP_FUNC_TPI_CONNECT) {
+		tpi_dly_cnt = data[2] | (data[3] << 8);
+
+		/* RST high */
+		ISP_OUT |= (1 << ISP_RST);
+		ISP_DDR |= (1 << ISP_RST);
+
+		clockWait(3);
+
+		/* RST low */
+		ISP_OUT &= ~(1 << ISP_RST);
+		ledRedOn();
+
+		clockWait(16);
+		tpi_init();
+
+		if (data[4] & USBASP_TPI_CONNECT_GUARDTIME) {
+			replyBuffer[0] = tpiNegotiateGuardTime();
+			len = 1;
+		}
+
+		prog_mode = PROG_MODE_TPI;
+	
+#ifdef USBASP_CAPTURE
+	} else if (data[1] == USBASP_FUNC_TPI_CALIBRATE
+			&& prog_mode == PROG_MODE_CAPTURE) {
+
+		/* timer 1 samples capture, stall data stage */
+		prog_state = PROG_STATE_IDLE;
+		len = 0xff;
+
+#endif
+	} else if (data[1] == USBASP_FUNC_TPI_CALIBRATE) {
+		uint16_t dly_cnt = tpi_dly_cnt;
+		uint16_t counts;
+		uint32_t freq = 0;
+
+		/* time idle bits with given delay, 0 = fast mode */
+		tpi_dly_cnt = data[2] | (data[3] << 8);
+		clockMeasureStart();
+		tpi_send_idle(TPI_CALIBRATE_BITS);
+		counts = clockMeasureStop();
+
+		/* check target answers at this rate */
+		replyBuffer[6] = 0;
+		if (prog_mode == PROG_MODE_TPI) {
+			tpi_send_byte(TPI_OP_SLDCS(TPIIR));
+			replyBuffer[6] = tpi_recv_byte() == TPIIR_ID;
+		}
+		tpi_dly_cnt = dly_cnt;
+
+		if (counts != 0 && counts != 0xffff) {
+			freq = (F_CPU / 8 * TPI_CALIBRATE_BITS) / counts;
+		}
+
+		/* TPI clock in Hz, timer counts (F_CPU/8), TPIIR read back ok */
+		replyBuffer[0] = freq;
+		replyBuffer[1] = freq >> 8;
+		replyBuffer[2] = freq >> 16;
+		replyBuffer[3] = freq >> 24;
+		replyBuffer[4] = counts;
+		replyBuffer[5] = counts >> 8;
+		len = 7;
+
+	} else if (data[1] == USBASP_FUNC_TPI_SCRIPT) {
+
+		/* sequence follows in data stage, stall if it does not fit */
+		prog_address = 0;
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_TPI_SCRIPT;
+		if (prog_nbytes > PROG_BUFFER_SIZE) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		len = 0xff; /* multiple out */
+
+	} else if (data[1] == USBASP_FUNC_TPI_SCRIPT_RESULT) {
+
+		usbMsgPtr = tpi_script_result;
+		len = tpi_script_nresult;
+		if (data[7] == 0 && data[6] < len) {
+			len = data[6];
+		}
+
+	} else if (data[1] >= USBASP_FUNC_TPI_CHIPERASE
+			&& data[1] <= USBASP_FUNC_TPI_WRITECONFIG
+			&& prog_mode != PROG_MODE_TPI) {
+
+		/* NVM operations need USBASP_FUNC_TPI_CONNECT, stall data stage */
+		prog_state = PROG_STATE_IDLE;
+		len = 0xff;
+
+	} else if (data[1] == USBASP_FUNC_TPI_CHIPERASE) {
+
+		/* dummy write to high byte of any flash word starts erase */
+		replyBuffer[0] = 0xFF;
+		replyBuffer[0] = tpiNvmOperation(NVMCMD_CHIP_ERASE,
+				TPI_FLASH_ADDR + 1, replyBuffer, 1);
+		len = 1;
+
+	} else if (data[1] == USBASP_FUNC_TPI_SECTIONERASE) {
+
+		/* dummy write to high byte of word in section given by wValue */
+		replyBuffer[0] = 0xFF;
+		replyBuffer[0] = tpiNvmOperation(NVMCMD_SECTION_ERASE,
+				((data[3] << 8) | data[2]) | 1, replyBuffer, 1);
+		len = 1;
+
+	} else if (data[1] == USBASP_FUNC_TPI_WRITECONFIG) {
+
+		/* erase configuration section, write word given by wValue */
+		replyBuffer[0] = 0xFF;
+		replyBuffer[0] = tpiNvmOperation(NVMCMD_SECTION_ERASE,
+				TPI_CONFIG_ADDR + 1, replyBuffer, 1);
+		if (replyBuffer[0] == TPI_NVM_READY) {
+			replyBuffer[0] = tpiNvmOperation(NVMCMD_WORD_WRITE,
+					TPI_CONFIG_ADDR, &data[2], 2);
+		}
+		len = 1;
+
+#ifdef USBASP_SPI
+	} else if (data[1] == USBASP_FUNC_SPI_CONNECT) {
+
+		/* set SCK speed */
+		if ((PINC & (1 << PC2)) == 0) {
+			ispSetSCKOption(USBASP_ISP_SCK_8);
+		} else {
+			ispSetSCKOption(prog_sck);
+		}
+
+		prog_mode = PROG_MODE_SPI;
+
+		ledRedOn();
+		ispConnectSPI();
+
+	} else if (data[1] == USBASP_FUNC_SPI_TRANSFER) {
+
+		/* bytes to send follow in data stage, wIndex: chip select */
+		prog_spi_flags = data[4];
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_buffer_len = 0;
+		if (prog_nbytes > PROG_BUFFER_SIZE) {
+			/* received bytes would not fit, stall data stage */
+			prog_state = PROG_STATE_IDLE;
+			len = 0xff;
+		} else {
+			if (prog_spi_flags & USBASP_SPI_CS_ASSERT) {
+				ispSelectSPI();
+			}
+			if (prog_nbytes == 0) {
+				/* no data stage, chip select only */
+				if (prog_spi_flags & USBASP_SPI_CS_RELEASE) {
+					ispDeselectSPI();
+				}
+			} else {
+				prog_address = 0;
+				prog_state = PROG_STATE_SPI_TRANSFER;
+				len = 0xff; /* multiple out */
+			}
+		}
+
+#endif
+#if defined(USBASP_SPI) || defined(USBASP_DW)
+	} else if (data[1] == USBASP_FUNC_SPI_RESULT
+			|| data[1] == USBASP_FUNC_DW_RESULT) {
+
+		usbMsgPtr = prog_buffer;
+		len = prog_buffer_len;
+		if (data[7] == 0 && data[6] < len) {
+			len = data[6];
+		}
+
+#endif
+#ifdef USBASP_SPIFLASH
+	} else if (data[1] >= USBASP_FUNC_SPIFLASH_ID
+			&& data[1] <= USBASP_FUNC_SPIFLASH_ERASE
+			&& prog_mode != PROG_MODE_SPI) {
+
+		/* RST is chip select only in SPI mode, stall data stage */
+		len = 0xff;
+
+	} else if (data[1] == USBASP_FUNC_SPIFLASH_ID) {
+
+		spiflashReadID(replyBuffer);
+		len = 3;
+
+	} else if (data[1] == USBASP_FUNC_SPIFLASH_READ) {
+
+		/* 24 bit address in wValue and wIndex low byte */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_nbytes = (data[7] << 8) | data[6];
+		spiflashReadStart(prog_address, data[5] & USBASP_SPIFLASH_FAST_READ);
+		prog_state = PROG_STATE_SPIFLASH_READ;
+		len = 0xff; /* multiple in */
+
+	} else if (data[1] == USBASP_FUNC_SPIFLASH_WRITE) {
+
+		/* 24 bit address in wValue and wIndex low byte */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_SPIFLASH_WRITE;
+		len = 0xff; /* multiple out */
+
+	} else if (data[1] == USBASP_FUNC_SPIFLASH_ERASE) {
+
+		/* address as above, instruction in wIndex high byte, sector and
+		 * block erase are waited for, host polls chip erase until done */
+		replyBuffer[0] = spiflashErase(data[5], data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16));
+		len = 1;
+
+#endif
+#ifdef USBASP_I2C
+	} else if (data[1] == USBASP_FUNC_I2C_CONNECT) {
+
+		/* half bit delay in wValue low byte */
+		prog_mode = PROG_MODE_I2C;
+
+		ledRedOn();
+		i2cConnect(data[2]);
+
+	} else if (data[1] == USBASP_FUNC_I2C_READ) {
+
+		/* memory address in wValue, wIndex: device address and flags */
+		prog_address = data[2] | ((unsigned int) data[3] << 8);
+		prog_nbytes = (data[7] << 8) | data[6];
+		if (i2cEepromReadStart(data[4], data[5], prog_address) == 0) {
+			prog_state = PROG_STATE_I2C_READ;
+			len = 0xff; /* multiple in */
+		} else {
+			len = 0; /* device not responding */
+		}
+
+	} else if (data[1] == USBASP_FUNC_I2C_WRITE) {
+
+		/* memory address in wValue, wIndex: device address and flags */
+		prog_address = data[2] | ((unsigned int) data[3] << 8);
+		prog_nbytes = (data[7] << 8) | data[6];
+		i2cEepromWriteStart(data[4], data[5]);
+		prog_state = PROG_STATE_I2C_WRITE;
+		len = 0xff; /* multiple out */
+
+#endif
+#ifdef USBASP_UART
+	} else if (data[1] == USBASP_FUNC_UART_CONNECT) {
+
+		unsigned int ubrr;
+
+		/* baud rate in wValue and wIndex low byte */
+		ubrr = uartConnect(data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16));
+		prog_mode = PROG_MODE_UART;
+
+		ledRedOn();
+
+		/* reply UBRR, bit 15 set if double speed */
+		replyBuffer[0] = ubrr;
+		replyBuffer[1] = ubrr >> 8;
+		len = 2;
+
+	} else if (data[1] == USBASP_FUNC_UART_READ) {
+
+		/* status byte and received bytes, transfer ends when buffer
+		 * is empty */
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_address = 0;
+		prog_state = PROG_STATE_UART_READ;
+		len = 0xff; /* multiple in */
+
+	} else if (data[1] == USBASP_FUNC_UART_WRITE) {
+
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_UART_WRITE;
+		len = 0xff; /* multiple out */
+
+#endif
+#ifdef USBASP_PDI
+	} else if (data[1] == USBASP_FUNC_PDI_CONNECT) {
+
+		/* half clock delay in wValue low byte */
+		replyBuffer[0] = pdiConnect(data[2]);
+		prog_mode = PROG_MODE_PDI;
+
+		ledRedOn();
+		len = 1;
+
+	} else if (data[1] == USBASP_FUNC_PDI_READ) {
+
+		/* 24 bit address in wValue and wIndex low byte,
+		 * memory type in high nibble of wIndex high byte */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_memtype = data[5] >> 4;
+		if (prog_memtype == PDI_MEM_RAW) {
+			prog_address += PDI_DATA_SPACE;
+		}
+		prog_nbytes = (data[7] << 8) | data[6];
+		pdiNvmStart(prog_memtype, 0);
+		prog_state = PROG_STATE_PDI_READ;
+		len = 0xff; /* multiple in */
+
+	} else if (data[1] == USBASP_FUNC_PDI_WRITE) {
+
+		/* address and memory type as above, block flags in low nibble */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_memtype = data[5] >> 4;
+		prog_blockflags = data[5] & 0x0F;
+		if (prog_memtype == PDI_MEM_RAW) {
+			prog_address += PDI_DATA_SPACE;
+		}
+		if (prog_blockflags & PROG_BLOCKFLAG_FIRST) {
+			prog_pageaddress = prog_address;
+			pdiNvmStart(prog_memtype, 1);
+		}
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_PDI_WRITE;
+		len = 0xff; /* multiple out */
+
+	} else if (data[1] == USBASP_FUNC_PDI_NVMCMD) {
+
+		/* command executed by CMDEX, e.g. chip erase */
+		replyBuffer[0] = pdiNvmExecute(data[2]);
+		len = 1;
+
+#endif
+#ifdef USBASP_UPDI
+	} else if (data[1] == USBASP_FUNC_UPDI_CONNECT) {
+
+		/* baud rate in wValue and wIndex low byte, options in high byte */
+		replyBuffer[0] = updiConnect(data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16),
+				data[5] & USBASP_UPDI_NVMPROG);
+		replyBuffer[1] = updiNvmVersion();
+		prog_mode = PROG_MODE_UPDI;
+
+		ledRedOn();
+		len = 2;
+
+	} else if (data[1] == USBASP_FUNC_UPDI_READ) {
+
+		/* 24 bit address in wValue and wIndex low byte */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_UPDI_READ;
+		len = 0xff; /* multiple in */
+
+	} else if (data[1] == USBASP_FUNC_UPDI_WRITE) {
+
+		/* address as above, block flags in low nibble of wIndex high
+		 * byte, NVM command issued after last block in high nibble */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_memtype = data[5] >> 4;
+		prog_blockflags = data[5] & 0x0F;
+		prog_nbytes = (data[7] << 8) | data[6];
+		len = 0xff; /* multiple out */
+		if (prog_memtype && updiNvmVersion() != 0) {
+			/* page write sequence of NVMCTRL v0 only, stall data */
+			prog_state = PROG_STATE_IDLE;
+		} else {
+			if ((prog_blockflags & PROG_BLOCKFLAG_FIRST) && prog_memtype) {
+				updiNvmCommand(UPDI_NVMCMD_PBC);
+			}
+			prog_state = PROG_STATE_UPDI_WRITE;
+		}
+
+	} else if (data[1] == USBASP_FUNC_UPDI_NVMCMD) {
+
+		/* write NVMCTRL.CTRLA and wait while busy */
+		replyBuffer[0] = updiNvmCommand(data[2]);
+		len = 1;
+
+#endif
+#ifdef USBASP_JTAG
+	} else if (data[1] == USBASP_FUNC_JTAG_CONNECT) {
+
+		unsigned long idcode;
+
+		/* half TCK delay in wValue low byte */
+		idcode = jtagConnect(data[2]);
+		prog_mode = PROG_MODE_JTAG;
+
+		ledRedOn();
+
+		replyBuffer[0] = idcode;
+		replyBuffer[1] = idcode >> 8;
+		replyBuffer[2] = idcode >> 16;
+		replyBuffer[3] = idcode >> 24;
+		len = 4;
+
+	} else if (data[1] == USBASP_FUNC_JTAG_COMMAND) {
+
+		unsigned int out;
+
+		/* 15 bit command in wValue, wIndex low byte: poll until done */
+		out = jtagCommand(data[2] | (data[3] << 8), data[4]);
+		replyBuffer[0] = out;
+		replyBuffer[1] = out >> 8;
+		len = 2;
+
+	} else if (data[1] == USBASP_FUNC_JTAG_READFLASH
+			|| data[1] == USBASP_FUNC_JTAG_WRITEFLASH) {
+
+		/* byte address in wValue and wIndex low byte,
+		 * page size in words in wIndex high byte */
+		prog_address = data[2] | ((unsigned int) data[3] << 8)
+				| ((unsigned long) data[4] << 16);
+		prog_pagesize = data[5] << 1;
+		if (prog_pagesize == 0) {
+			prog_pagesize = 256;
+		}
+		prog_nbytes = (data[7] << 8) | data[6];
+		if (data[1] == USBASP_FUNC_JTAG_READFLASH) {
+			prog_state = PROG_STATE_JTAG_READ;
+		} else {
+			prog_state = PROG_STATE_JTAG_WRITE;
+		}
+		len = 0xff; /* multiple in/out */
+
+#endif
+#ifdef USBASP_DW
+#ifdef USBASP_CAPTURE
+	} else if (data[1] == USBASP_FUNC_DW_CONNECT
+			&& prog_mode == PROG_MODE_CAPTURE) {
+
+		/* timer 1 samples capture, stop it first */
+		prog_buffer[0] = USBASP_DW_ERROR;
+		prog_buffer_len = 1;
+
+#endif
+	} else if (data[1] == USBASP_FUNC_DW_CONNECT) {
+
+		/* bit time and signature follow in USBASP_FUNC_DW_RESULT */
+		prog_mode = PROG_MODE_DW;
+		ledRedOn();
+		dwQueue(PROG_DW_CONNECT);
+
+	} else if ((data[1] == USBASP_FUNC_DW_READ
+			|| data[1] == USBASP_FUNC_DW_DISABLE)
+			&& prog_mode != PROG_MODE_DW) {
+
+		/* RST is driven only after USBASP_FUNC_DW_CONNECT */
+		prog_buffer[0] = USBASP_DW_ERROR;
+		prog_buffer_len = 1;
+
+	} else if (data[1] == USBASP_FUNC_DW_READ) {
+
+		/* address in wValue, count in wIndex low byte, memory type
+		 * and EECR I/O address in high byte (type << 6 | eecr) */
+		prog_address = data[2] | (data[3] << 8);
+		prog_dw_len = data[4];
+		prog_memtype = data[5] >> 6;
+		prog_dw_eecr = data[5] & 0x3F;
+		if (prog_dw_len > PROG_BUFFER_SIZE - 1) {
+			/* result must fit behind status byte */
+			prog_buffer[0] = USBASP_DW_ERROR;
+			prog_buffer_len = 1;
+		} else {
+			dwQueue(PROG_DW_READ);
+		}
+
+	} else if (data[1] == USBASP_FUNC_DW_DISABLE) {
+
+		dwQueue(PROG_DW_DISABLE);
+
+#endif
+#ifdef USBASP_CAPTURE
+	} else if (data[1] == USBASP_FUNC_CAPTURE_START) {
+
+		/* sample period in wValue (F_CPU/8 counts), samples in wIndex */
+#ifdef USBASP_DW
+		if (prog_dw_op != PROG_DW_NONE) {
+			/* pending debugWIRE operation would restart timer 1 */
+			prog_dw_op = PROG_DW_NONE;
+			prog_buffer[0] = USBASP_DW_ERROR;
+			prog_buffer_len = 1;
 		}
-		prog_nbytes = (data[7] << 8) | data[6];
-		prog_state = PROG_STATE_WRITEFLASH;
-		len = 0xff; /* multiple out */
+#endif
+		ispDisconnect();
+		captureStart(data[2] | (data[3] << 8), data[4] | (data[5] << 8));
+		prog_mode = PROG_MODE_CAPTURE;
 
-	} else if (data[1] == USBASP_FUNC_WRITEEEPROM) {
+	} else if (data[1] == USBASP_FUNC_CAPTURE_READ) {
 
-		if (!prog_address_newmode)
-			prog_address = (data[3] << 8) | data[2];
+		/* encoded transitions, transfer ends when buffer is empty */
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_CAPTURE_READ;
+		len = 0xff; /* multiple in */
 
-		prog_pagesize = 0;
-		prog_blockflags = 0;
+#endif
+#ifdef USBASP_MACRO
+	} else if (data[1] == USBASP_FUNC_MACRO_STORE) {
+
+		/* slot in wValue low byte, macro follows in data stage */
+		prog_macro_slot = data[2] % ISP_MACRO_SLOTS;
+		memset(prog_buffer, ISP_MACRO_END, ISP_MACRO_SIZE);
+		prog_address = 0;
 		prog_nbytes = (data[7] << 8) | data[6];
-		prog_state = PROG_STATE_WRITEEEPROM;
-		len = 0xff; /* multiple out */
+		if (prog_nbytes > ISP_MACRO_SIZE) {
+			/* cut off macro must not be stored, stall data stage */
+			prog_state = PROG_STATE_IDLE;
+			len = 0xff;
+		} else if (prog_nbytes == 0) {
+			/* empty macro clears slot */
+			eeprom_update_block(prog_buffer, eeprom_macros[prog_macro_slot],
+					ISP_MACRO_SIZE);
+		} else {
+			prog_state = PROG_STATE_MACRO_STORE;
+			len = 0xff; /* multiple out */
+		}
 
-	} else if (data[1] == USBASP_FUNC_SETLONGADDRESS) {
+	} else if (data[1] == USBASP_FUNC_MACRO_RUN) {
 
-		/* set new mode of address delivering (ignore address delivered in commands) */
-		prog_address_newmode = 1;
-		/* set new address */
-		prog_address = *((unsigned long*) &data[2]);
+		/* slot in wValue low byte */
+		eeprom_read_block(prog_buffer, eeprom_macros[data[2] % ISP_MACRO_SLOTS],
+				ISP_MACRO_SIZE);
+		ispRunMacro(replyBuffer);
+		len = 6;
 
-	} else if (data[1] == USBASP_FUNC_SETISPSCK) {
+#endif
+	} else if (data[1] == USBASP_FUNC_COUNTERS) {
 
-		/* set sck option */
-		prog_sck = data[2];
-		replyBuffer[0] = 0;
-		len = 1;
+		/* copy and reset, reply is sent after setup returns */
+		prog_counters.isp = isp_counters;
+		prog_counters.tpi_recv_timeouts = tpi_recv_timeouts;
+		memcpy(prog_buffer, &prog_counters, sizeof(prog_counters));
+		memset(&prog_counters, 0, sizeof(prog_counters));
+		memset(&isp_counters, 0, sizeof(isp_counters));
+		tpi_recv_timeouts = 0;
 
-	} else if (data[1] == USBASP_FUNC_TPI_CONNECT) {
-		tpi_dly_cnt = data[2] | (data[3] << 8);
+		usbMsgPtr = prog_buffer;
+		len = sizeof(prog_counters);
 
-		/* RST high */
-		ISP_OUT |= (1 << ISP_RST);
-		ISP_DDR |= (1 << ISP_RST);
+#ifdef USBASP_TRACE
+	} else if (data[1] == USBASP_FUNC_TRACE_READ) {
 
-		clockWait(3);
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_TRACE_READ;
+		len = 0xff; /* multiple in */
 
-		/* RST low */
-		ISP_OUT &= ~(1 << ISP_RST);
-		ledRedOn();
+#endif
+#ifdef USBASP_CAPTURE
+	} else if (data[1] == USBASP_FUNC_CAPTURE_STOP) {
 
-		clockWait(16);
-		tpi_init();
-	
+		replyBuffer[0] = captureStop();
+		replyBuffer[1] = captureMissed();
+		replyBuffer[2] = captureMissed() >> 8;
+		prog_mode = PROG_MODE_ISP;
+		len = 3;
+
+#endif
 	} else if (data[1] == USBASP_FUNC_TPI_DISCONNECT) {
 
 		tpi_send_byte(TPI_OP_SSTCS(TPISR));
@@ -190,12 +1231,16 @@ uchar usbFunctionSetup(uchar data[8]) {
 		ISP_OUT &= ~((1 << ISP_RST) | (1 << ISP_SCK) | (1 << ISP_MOSI));
 
 		ledRedOff();
+
+		prog_mode = PROG_MODE_ISP;
 	
 	} else if (data[1] == USBASP_FUNC_TPI_RAWREAD) {
 		replyBuffer[0] = tpi_recv_byte();
 		len = 1;
 	
 	} else if (data[1] == USBASP_FUNC_TPI_RAWWRITE) {
+		/* raw access may change PR */
+		tpi_pr_valid = 0;
 		tpi_send_byte(data[2]);
 	
 	} else if (data[1] == USBASP_FUNC_TPI_READBLOCK) {
@@ -210,29 +1255,240 @@ uchar usbFunctionSetup(uchar data[8]) {
 		prog_state = PROG_STATE_TPI_WRITE;
 		len = 0xff; /* multiple out */
 	
+	} else if (data[1] == USBASP_FUNC_IDENTIFY) {
+
+		if (prog_mode == PROG_MODE_TPI) {
+			tpiIdentify(replyBuffer);
+		} else {
+			ispIdentify(replyBuffer);
+		}
+		len = 8;
+
+	} else if (data[1] == USBASP_FUNC_SETPROFILE) {
+
+		/* ispProfile (times in us) follows in data stage, stall data
+		 * stage if length differs */
+		prog_address = 0;
+		prog_nbytes = (data[7] << 8) | data[6];
+		prog_state = PROG_STATE_SETPROFILE;
+		if (prog_nbytes != sizeof(prog_profile)) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		len = 0xff; /* multiple out */
+
+	} else if (data[1] == USBASP_FUNC_SETTINGS) {
+
+		if (data[2] == USBASP_SETTINGS_CLEAR) {
+			settingsClear();
+		} else if (data[2] == USBASP_SETTINGS_STORE
+				&& (data[3] == ATM || data[3] == S5x)
+				&& data[4] <= USBASP_ISP_SCK_1500) {
+			prog_settings.flags |= PROG_SETTINGS_TARGET;
+			prog_settings.chip = data[3];
+			prog_settings.sck = data[4];
+			settingsSave();
+			chip = data[3];
+		}
+
+		replyBuffer[0] = prog_settings.flags;
+		replyBuffer[1] = prog_settings.chip;
+		replyBuffer[2] = prog_settings.sck;
+		replyBuffer[3] = 0;
+		len = 4;
+
 	} else if (data[1] == USBASP_FUNC_GETCAPABILITIES) {
-		replyBuffer[0] = USBASP_CAP_0_TPI;
-		replyBuffer[1] = 0;
-		replyBuffer[2] = 0;
+		replyBuffer[0] = USBASP_CAP_0_TPI | USBASP_CAP_0_IDENTIFY
+				| USBASP_CAP_0_PROFILE | USBASP_CAP_0_SWITCHSCK
+				| USBASP_CAP_0_SETTINGS
+				| USBASP_CAP_0_TPI_GUARDTIME | USBASP_CAP_0_TPI_SCRIPT;
+#ifdef TPI_WITH_OPTO
+		replyBuffer[0] |= USBASP_CAP_0_TPI_FAST;
+#endif
+		replyBuffer[1] = USBASP_CAP_1_TPI_NVMOPS;
+		replyBuffer[2] = USBASP_CAP_2_COUNTERS;
+#ifdef USBASP_SPI
+		replyBuffer[1] |= USBASP_CAP_1_SPI;
+#endif
+#ifdef USBASP_SPIFLASH
+		replyBuffer[1] |= USBASP_CAP_1_SPIFLASH;
+#endif
+#ifdef USBASP_I2C
+		replyBuffer[1] |= USBASP_CAP_1_I2C;
+#endif
+#ifdef USBASP_UART
+		replyBuffer[1] |= USBASP_CAP_1_UART;
+#endif
+#ifdef USBASP_PDI
+		replyBuffer[1] |= USBASP_CAP_1_PDI;
+#endif
+#ifdef USBASP_UPDI
+		replyBuffer[1] |= USBASP_CAP_1_UPDI;
+#endif
+#ifdef USBASP_JTAG
+		replyBuffer[1] |= USBASP_CAP_1_JTAG;
+#endif
+#ifdef USBASP_DW
+		replyBuffer[2] |= USBASP_CAP_2_DW;
+#endif
+#ifdef USBASP_CAPTURE
+		replyBuffer[2] |= USBASP_CAP_2_CAPTURE;
+#endif
+#ifdef USBASP_MACRO
+		replyBuffer[2] |= USBASP_CAP_2_MACRO;
+#endif
+#ifdef USBASP_TRACE
+		replyBuffer[2] |= USBASP_CAP_2_TRACE;
+#endif
 		replyBuffer[3] = 0;
 		len = 4;
 	}
 
-	usbMsgPtr = replyBuffer;
+	if (len == 0xff) {
+		countTransfer();
+	} else {
+		traceRequestEnd();
+	}
 
 	return len;
 }
 
-uchar usbFunctionRead(uchar *data, uchar len) {
+static uchar progRead(uchar *data, uchar len) {
 
 	uchar i;
 
 	/* check if programmer is in correct read state */
 	if ((prog_state != PROG_STATE_READFLASH) && (prog_state
-			!= PROG_STATE_READEEPROM) && (prog_state != PROG_STATE_TPI_READ)) {
+			!= PROG_STATE_READEEPROM) && (prog_state != PROG_STATE_TPI_READ)
+			&& (prog_state != PROG_STATE_SPIFLASH_READ)
+			&& (prog_state != PROG_STATE_I2C_READ)
+			&& (prog_state != PROG_STATE_UART_READ)
+			&& (prog_state != PROG_STATE_PDI_READ)
+			&& (prog_state != PROG_STATE_UPDI_READ)
+			&& (prog_state != PROG_STATE_JTAG_READ)
+			&& (prog_state != PROG_STATE_CAPTURE_READ)
+			&& (prog_state != PROG_STATE_TRACE_READ)) {
 		return 0xff;
 	}
 
+#ifdef USBASP_TRACE
+	/* fill packet with trace entries, short packet if nothing left */
+	if (prog_state == PROG_STATE_TRACE_READ) {
+		if (len > prog_nbytes) {
+			len = prog_nbytes;
+		}
+		len = traceRead(data, len);
+		prog_nbytes -= len;
+		if (len < 8) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		return len;
+	}
+#endif
+
+#ifdef USBASP_CAPTURE
+	/* fill packet capture mode, short packet if nothing left */
+	if (prog_state == PROG_STATE_CAPTURE_READ) {
+		if (len > prog_nbytes) {
+			len = prog_nbytes;
+		}
+		len = captureRead(data, len);
+		prog_nbytes -= len;
+		if (len < 8) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		return len;
+	}
+#endif
+
+#ifdef USBASP_JTAG
+	/* fill packet JTAG mode, PROG_PAGEREAD streams the page */
+	if (prog_state == PROG_STATE_JTAG_READ) {
+		for (i = 0; i < len; i++) {
+			data[i] = jtagReadFlash(prog_address++, prog_pagesize,
+					--prog_nbytes == 0);
+		}
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		return len;
+	}
+#endif
+
+#ifdef USBASP_UPDI
+	/* fill packet UPDI mode, one REPEAT per packet */
+	if (prog_state == PROG_STATE_UPDI_READ) {
+		if (updiReadBlock(prog_address, data, len)) {
+			prog_state = PROG_STATE_IDLE;
+			return 0xff;
+		}
+		prog_address += len;
+		return len;
+	}
+#endif
+
+#ifdef USBASP_PDI
+	/* fill packet PDI mode, one REPEAT per packet */
+	if (prog_state == PROG_STATE_PDI_READ) {
+		if (pdiReadBlock(prog_address, data, len)) {
+			prog_state = PROG_STATE_IDLE;
+			return 0xff;
+		}
+		prog_address += len;
+		return len;
+	}
+#endif
+
+#ifdef USBASP_UART
+	/* fill packet UART mode, short packet if nothing left */
+	if (prog_state == PROG_STATE_UART_READ) {
+		if (len > prog_nbytes) {
+			len = prog_nbytes;
+		}
+		uartPoll();
+		if (prog_address == 0 && len) {
+			/* first packet starts with status */
+			data[0] = uartStatus();
+			len = 1 + uartRead(&data[1], len - 1);
+			prog_address = 1;
+		} else {
+			len = uartRead(data, len);
+		}
+		prog_nbytes -= len;
+		if (len < 8) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		return len;
+	}
+#endif
+
+#ifdef USBASP_I2C
+	/* fill packet I2C mode, sequential read */
+	if (prog_state == PROG_STATE_I2C_READ) {
+		for (i = 0; i < len; i++) {
+			data[i] = i2cEepromRead(--prog_nbytes == 0);
+		}
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+		}
+		return len;
+	}
+#endif
+
+#ifdef USBASP_SPIFLASH
+	/* fill packet SPI flash mode, continuous read */
+	if (prog_state == PROG_STATE_SPIFLASH_READ) {
+		for (i = 0; i < len; i++) {
+			data[i] = ispTransmit(0);
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			spiflashReadEnd();
+			prog_state = PROG_STATE_IDLE;
+		}
+		return len;
+	}
+#endif
+
 	/* fill packet TPI mode */
 	if(prog_state == PROG_STATE_TPI_READ)
 	{
@@ -244,11 +1500,22 @@ uchar usbFunctionRead(uchar *data, uchar len) {
 	/* fill packet ISP mode */
 	for (i = 0; i < len; i++) {
 		if (prog_state == PROG_STATE_READFLASH) {
-			data[i] = ispReadFlash(prog_address);
+			if (chip == S5x) {
+				data[i] = ispReadFlashS5x(prog_address);
+			} else {
+				data[i] = ispReadFlash(prog_address);
+			}
 		} else {
 			data[i] = ispReadEEPROM(prog_address);
 		}
 		prog_address++;
+		prog_nbytes--;
+	}
+
+	/* echo still wrong after retries */
+	if (isp_echo_failed) {
+		prog_state = PROG_STATE_IDLE;
+		return 0xff;
 	}
 
 	/* last packet? */
@@ -259,17 +1526,209 @@ uchar usbFunctionRead(uchar *data, uchar len) {
 	return len;
 }
 
-uchar usbFunctionWrite(uchar *data, uchar len) {
+static uchar progWrite(uchar *data, uchar len) {
 
 	uchar retVal = 0;
+	uchar blocking = 0;
 	uchar i;
 
 	/* check if programmer is in correct write state */
 	if ((prog_state != PROG_STATE_WRITEFLASH) && (prog_state
-			!= PROG_STATE_WRITEEEPROM) && (prog_state != PROG_STATE_TPI_WRITE)) {
+			!= PROG_STATE_WRITEEEPROM) && (prog_state != PROG_STATE_TPI_WRITE)
+			&& (prog_state != PROG_STATE_SETPROFILE)
+			&& (prog_state != PROG_STATE_TPI_SCRIPT)
+			&& (prog_state != PROG_STATE_SPI_TRANSFER)
+			&& (prog_state != PROG_STATE_SPIFLASH_WRITE)
+			&& (prog_state != PROG_STATE_I2C_WRITE)
+			&& (prog_state != PROG_STATE_UART_WRITE)
+			&& (prog_state != PROG_STATE_PDI_WRITE)
+			&& (prog_state != PROG_STATE_UPDI_WRITE)
+			&& (prog_state != PROG_STATE_JTAG_WRITE)
+			&& (prog_state != PROG_STATE_MACRO_STORE)) {
 		return 0xff;
 	}
 
+#ifdef USBASP_MACRO
+	if (prog_state == PROG_STATE_MACRO_STORE) {
+		for (i = 0; i < len; i++) {
+			prog_buffer[prog_address++] = data[i];
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			eeprom_update_block(prog_buffer, eeprom_macros[prog_macro_slot],
+					ISP_MACRO_SIZE);
+			prog_state = PROG_STATE_IDLE;
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_JTAG
+	if (prog_state == PROG_STATE_JTAG_WRITE) {
+		for (i = 0; i < len; i++) {
+			if (jtagWriteFlash(prog_address++, prog_pagesize, data[i],
+					--prog_nbytes == 0)) {
+				prog_state = PROG_STATE_IDLE;
+				return 0xff;
+			}
+		}
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_UPDI
+	if (prog_state == PROG_STATE_UPDI_WRITE) {
+		if (updiWriteBlock(prog_address, data, len)) {
+			prog_state = PROG_STATE_IDLE;
+			return 0xff;
+		}
+		prog_address += len;
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			if ((prog_blockflags & PROG_BLOCKFLAG_LAST) && prog_memtype) {
+				return updiNvmCommand(prog_memtype) ? 0xff : 1;
+			}
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_PDI
+	if (prog_state == PROG_STATE_PDI_WRITE) {
+		if (pdiWriteBlock(prog_address, data, len)) {
+			prog_state = PROG_STATE_IDLE;
+			return 0xff;
+		}
+		prog_address += len;
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			if (prog_blockflags & PROG_BLOCKFLAG_LAST) {
+				return pdiNvmWritePage(prog_memtype, prog_pageaddress) ? 0xff : 1;
+			}
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_UART
+	if (prog_state == PROG_STATE_UART_WRITE) {
+		uartWrite(data, len);
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_I2C
+	if (prog_state == PROG_STATE_I2C_WRITE) {
+		for (i = 0; i < len; i++) {
+			if (i2cEepromWriteByte(prog_address++, data[i])) {
+				prog_state = PROG_STATE_IDLE;
+				return 0xff; /* no acknowledge */
+			}
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			return i2cEepromWriteEnd() ? 0xff : 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_SPIFLASH
+	if (prog_state == PROG_STATE_SPIFLASH_WRITE) {
+		for (i = 0; i < len; i++) {
+			if (spiflashWriteByte(prog_address++, data[i])
+					& SPIFLASH_SR_WIP) {
+				/* page program timed out */
+				prog_state = PROG_STATE_IDLE;
+				return 0xff;
+			}
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			if (spiflashWriteEnd() & SPIFLASH_SR_WIP) {
+				return 0xff;
+			}
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef USBASP_SPI
+	if (prog_state == PROG_STATE_SPI_TRANSFER) {
+		/* full duplex, received bytes replace sent ones */
+		for (i = 0; i < len; i++) {
+			prog_buffer[prog_buffer_len++] = ispTransmit(data[i]);
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			if (prog_spi_flags & USBASP_SPI_CS_RELEASE) {
+				ispDeselectSPI();
+			}
+			prog_state = PROG_STATE_IDLE;
+			return 1;
+		}
+		return 0;
+	}
+#endif
+
+	if (prog_state == PROG_STATE_TPI_SCRIPT) {
+		for (i = 0; i < len; i++) {
+			prog_buffer[prog_address++] = data[i];
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			/* malformed sequence is not run at all */
+			if (tpiCheckScript(prog_address)) {
+				tpi_script_nresult = 0;
+				return 0xff;
+			}
+			/* sequence may change PR */
+			tpi_pr_valid = 0;
+			if (tpiRunScript(prog_address)) {
+				return 0xff;
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	if (prog_state == PROG_STATE_SETPROFILE) {
+		for (i = 0; i < len; i++) {
+			((uchar *) &prog_profile)[prog_address++] = data[i];
+		}
+		prog_nbytes -= len;
+		if (prog_nbytes == 0) {
+			prog_state = PROG_STATE_IDLE;
+			if (!profileValid(&prog_profile)) {
+				return 0xff;
+			}
+			ispSetProfile(&prog_profile);
+			prog_settings.profile = prog_profile;
+			prog_settings.flags |= PROG_SETTINGS_PROFILE;
+			settingsSave();
+			return 1;
+		}
+		return 0;
+	}
+
 	if (prog_state == PROG_STATE_TPI_WRITE)
 	{
 		tpi_write_block(prog_address, data, len);
@@ -288,9 +1747,15 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
 		if (prog_state == PROG_STATE_WRITEFLASH) {
 			/* Flash */
 
-			if (prog_pagesize == 0) {
+			if (chip == S5x) {
+				/* own page mode, AVR page size and flushes don't apply */
+				ispWriteFlashS5x(prog_address, data[i], prog_nbytes >= 256
+						|| !(prog_blockflags & PROG_BLOCKFLAG_LAST));
+				blocking = 1;
+			} else if (prog_pagesize == 0) {
 				/* not paged */
 				ispWriteFlash(prog_address, data[i], 1);
+				blocking = 1;
 			} else {
 				/* paged */
 				ispWriteFlash(prog_address, data[i], 0);
@@ -298,31 +1763,74 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
 				if (prog_pagecounter == 0) {
 					ispFlushPage(prog_address, data[i]);
 					prog_pagecounter = prog_pagesize;
+					blocking = 1;
 				}
 			}
 
 		} else {
 			/* EEPROM */
-			ispWriteEEPROM(prog_address, data[i]);
+			if (isp_profile.eeprom_pagesize == 0) {
+				ispWriteEEPROM(prog_address, data[i]);
+				blocking = 1;
+			} else {
+				/* paged, flush at end of page or block */
+				ispLoadEEPROMPage(prog_address, data[i]);
+				if ((((uchar) prog_address + 1)
+						& (isp_profile.eeprom_pagesize - 1)) == 0
+						|| prog_nbytes == 1) {
+					ispFlushEEPROMPage(prog_address);
+					blocking = 1;
+				}
+			}
 		}
 
 		prog_nbytes--;
 
 		if (prog_nbytes == 0) {
 			prog_state = PROG_STATE_IDLE;
-			if ((prog_blockflags & PROG_BLOCKFLAG_LAST) && (prog_pagecounter
-					!= prog_pagesize)) {
+			if ((prog_blockflags & PROG_BLOCKFLAG_LAST) && (chip != S5x)
+					&& (prog_pagecounter != prog_pagesize)) {
 
 				/* last block and page flush pending, so flush it now */
 				ispFlushPage(prog_address, data[i]);
+				blocking = 1;
 			}
 
 			retVal = 1; // Need to return 1 when no more data is to be received
 		}
 
 		prog_address++;
+
+		if (isp_echo_failed) {
+			/* SCK is lowered, host repeats page or block from its start */
+			prog_state = PROG_STATE_IDLE;
+			prog_pagecounter = prog_pagesize;
+			return 0xff;
+		}
+	}
+
+	if (blocking) {
+		prog_counters.write_blocking++;
+	}
+
+	return retVal;
+}
+
+uchar usbFunctionRead(uchar *data, uchar len) {
+
+	len = progRead(data, len);
+	if (len != 0xff) {
+		prog_counters.read_bytes[prog_count_type] += len;
 	}
+	return len;
+}
+
+uchar usbFunctionWrite(uchar *data, uchar len) {
+	uchar retVal = progWrite(data, len);
 
+	if (retVal != 0xff) {
+		prog_counters.write_bytes[prog_count_type] += len;
+	}
 	return retVal;
 }
 
@@ -352,16 +1860,49 @@ int main(void) {
 	DDRC = 0x03;
 	PORTC = 0xfe;
 
-	chip=ATM;
+	/* start with family of last session */
+	settingsLoad();
+	if (prog_settings.flags & PROG_SETTINGS_TARGET) {
+		chip = prog_settings.chip;
+	} else {
+		chip = ATM;
+	}
 
 	/* init timer */
 	clockInit();
+	traceInit();
 
 	/* main event loop */
 	usbInit();
 	sei();
 	for (;;) {
 		usbPoll();
+#ifdef USBASP_UART
+		if (prog_mode == PROG_MODE_UART) {
+			uartPoll();
+		}
+#endif
+#ifdef USBASP_PDI
+		if (prog_mode == PROG_MODE_PDI) {
+			/* PDI disables itself below ~10 kHz clock */
+			pdiSendIdle(1);
+		}
+#endif
+#ifdef USBASP_CAPTURE
+		if (prog_mode == PROG_MODE_CAPTURE) {
+			captureRun();
+		}
+#endif
+#ifdef USBASP_DW
+		if (prog_dw_op != PROG_DW_NONE && (usbTxLen & 0x10)) {
+			/* debugWIRE disables interrupts per byte, run it between requests */
+			dwRunPending();
+		}
+#endif
+		if (prog_state == PROG_STATE_IDLE) {
+			/* multi packet transfer finished */
+			traceRequestEnd();
+		}
 	}
 	return 0;
 }
@@ -0,0 +1,285 @@
+/*
+ * pdi.c - part of USBasp
+ *
+ * Description....: Provides functions for programming ATxmega devices
+ *                  over PDI (PDI_CLK = RST, PDI_DATA = MOSI)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include <util/delay_basic.h>
+#include "isp.h"
+#include "clock.h"
+#include "pdi.h"
+
+#ifdef USBASP_PDI
+
+/* idle bits to wait for start bit, guard time plus margin */
+#define PDI_RECV_TIMEOUT  32
+
+static uchar pdi_delay;
+
+static void pdiDelay() {
+	if (pdi_delay) {
+		_delay_loop_1(pdi_delay);
+	}
+}
+
+/* one clock cycle: data changes while clock low, sampled on rising edge */
+static uchar pdiBit(uchar b) {
+	uchar in;
+
+	if (b) {
+		ISP_OUT |= (1 << PDI_DATA);
+	} else {
+		ISP_OUT &= ~(1 << PDI_DATA);
+	}
+	pdiDelay();
+	ISP_OUT |= (1 << PDI_CLK);
+	in = ISP_IN & (1 << PDI_DATA);
+	pdiDelay();
+	ISP_OUT &= ~(1 << PDI_CLK);
+
+	return in;
+}
+
+void pdiSendIdle(uchar bits) {
+	ISP_DDR |= (1 << PDI_DATA);
+	while (bits--) {
+		pdiBit(1);
+	}
+}
+
+static void pdiSendByte(uchar b) {
+	uchar i, parity = 0;
+
+	ISP_DDR |= (1 << PDI_DATA);
+
+	/* start bit, 8 data bits, even parity, 2 stop bits */
+	pdiBit(0);
+	for (i = 0; i < 8; i++) {
+		parity ^= b;
+		pdiBit(b & 1);
+		b >>= 1;
+	}
+	pdiBit(parity & 1);
+	pdiBit(1);
+	pdiBit(1);
+}
+
+/* receive byte, returns 0 if frame was valid */
+static uchar pdiRecvByte(uchar *b) {
+	uchar i, parity = 0, timeout = PDI_RECV_TIMEOUT;
+
+	/* release data line, pull-up keeps it idle */
+	ISP_DDR &= ~(1 << PDI_DATA);
+
+	while (pdiBit(1)) {
+		if (--timeout == 0) {
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 8; i++) {
+		*b >>= 1;
+		if (pdiBit(1)) {
+			*b |= 0x80;
+			parity ^= 1;
+		}
+	}
+	if (pdiBit(1)) {
+		parity ^= 1;
+	}
+
+	/* stop bits */
+	if (!pdiBit(1) || !pdiBit(1)) {
+		return 1;
+	}
+
+	return parity;
+}
+
+static void pdiSendLong(unsigned long l) {
+	pdiSendByte(l);
+	pdiSendByte(l >> 8);
+	pdiSendByte(l >> 16);
+	pdiSendByte(l >> 24);
+}
+
+static void pdiStore(unsigned long address, uchar b) {
+	pdiSendByte(PDI_STS | PDI_ADDR_LONG | PDI_SIZE_BYTE);
+	pdiSendLong(address);
+	pdiSendByte(b);
+}
+
+static uchar pdiLoad(unsigned long address, uchar *b) {
+	pdiSendByte(PDI_LDS | PDI_ADDR_LONG | PDI_SIZE_BYTE);
+	pdiSendLong(address);
+	return pdiRecvByte(b);
+}
+
+/* set pointer register and repeat counter for block transfer */
+static void pdiBlockStart(unsigned long address, uchar len) {
+	pdiSendByte(PDI_ST | PDI_PTR_REG | PDI_SIZE_LONG);
+	pdiSendLong(address);
+	pdiSendByte(PDI_REPEAT | PDI_SIZE_BYTE);
+	pdiSendByte(len - 1);
+}
+
+static uchar pdiNvmWait() {
+	uchar timeout = PDI_T_NVM;
+	uint8_t starttime = TIMERVALUE;
+	uchar status;
+
+	for (;;) {
+		if (pdiLoad(PDI_NVM_STATUS, &status) == 0
+				&& !(status & PDI_NVM_BUSY)) {
+			return 0;
+		}
+
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			if (--timeout == 0) {
+				return 1; /* error */
+			}
+		}
+	}
+}
+
+uchar pdiConnect(uchar delay) {
+	uchar i, status;
+	uchar timeout = PDI_T_NVMEN;
+	uint8_t starttime;
+	static const uchar key[8] = { 0xFF, 0x88, 0xD8, 0xCD, 0x45, 0xAB, 0x89,
+			0x12 };
+
+	pdi_delay = delay;
+
+	/* no hardware SPI */
+	SPCR = 0;
+
+	/* clock (RST) high, then data high disables reset function */
+	ISP_OUT |= (1 << PDI_CLK);
+	ISP_DDR |= (1 << PDI_CLK);
+	ISP_OUT |= (1 << PDI_DATA);
+	ISP_DDR |= (1 << PDI_DATA);
+
+	/* clock must start within 100 us, then 16 idle bits */
+	clockWaitTicks(CLOCK_US_TO_TICKS(50));
+
+	pdiSendIdle(16);
+
+	pdiSendByte(PDI_STCS | PDI_REG_CTRL);
+	pdiSendByte(PDI_CTRL_GT_8);
+	pdiSendByte(PDI_STCS | PDI_REG_RESET);
+	pdiSendByte(PDI_RESET_KEY);
+
+	pdiSendByte(PDI_KEY);
+	for (i = 0; i < 8; i++) {
+		pdiSendByte(key[i]);
+	}
+
+	/* wait for NVM interface */
+	starttime = TIMERVALUE;
+	for (;;) {
+		pdiSendByte(PDI_LDCS | PDI_REG_STATUS);
+		if (pdiRecvByte(&status) == 0 && (status & PDI_STATUS_NVMEN)) {
+			return 0;
+		}
+
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			if (--timeout == 0) {
+				return 1; /* error */
+			}
+		}
+	}
+}
+
+void pdiDisconnect() {
+
+	pdiSendByte(PDI_STCS | PDI_REG_RESET);
+	pdiSendByte(0);
+	pdiSendIdle(16);
+
+	/* PDI disables itself without clock */
+	ISP_DDR &= ~((1 << PDI_CLK) | (1 << PDI_DATA));
+	ISP_OUT &= ~((1 << PDI_CLK) | (1 << PDI_DATA));
+}
+
+uchar pdiReadBlock(unsigned long address, uchar *data, uchar len) {
+	uchar i, error = 0;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	pdiBlockStart(address, len);
+	pdiSendByte(PDI_LD | PDI_PTR_INC | PDI_SIZE_BYTE);
+
+	for (i = 0; i < len; i++) {
+		error |= pdiRecvByte(&data[i]);
+	}
+
+	return error;
+}
+
+uchar pdiWriteBlock(unsigned long address, uchar *data, uchar len) {
+	uchar i;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	pdiBlockStart(address, len);
+	pdiSendByte(PDI_ST | PDI_PTR_INC | PDI_SIZE_BYTE);
+
+	for (i = 0; i < len; i++) {
+		pdiSendByte(data[i]);
+	}
+
+	/* stores are not acknowledged, check target still answers */
+	return pdiNvmWait();
+}
+
+void pdiNvmStart(uchar memtype, uchar write) {
+
+	if (memtype == PDI_MEM_RAW) {
+		pdiStore(PDI_NVM_CMD, PDI_NVMCMD_NOP);
+	} else if (!write) {
+		pdiStore(PDI_NVM_CMD, PDI_NVMCMD_READ_NVM);
+	} else if (memtype == PDI_MEM_FLASH) {
+		pdiNvmExecute(PDI_NVMCMD_ERASE_FLASH_BUF);
+		pdiStore(PDI_NVM_CMD, PDI_NVMCMD_LOAD_FLASH_BUF);
+	} else {
+		pdiNvmExecute(PDI_NVMCMD_ERASE_EE_BUF);
+		pdiStore(PDI_NVM_CMD, PDI_NVMCMD_LOAD_EE_BUF);
+	}
+}
+
+uchar pdiNvmWritePage(uchar memtype, unsigned long address) {
+
+	if (memtype == PDI_MEM_RAW) {
+		return 0;
+	}
+
+	/* dummy write into page starts erase and write */
+	if (memtype == PDI_MEM_FLASH) {
+		pdiStore(PDI_NVM_CMD, PDI_NVMCMD_WRITE_FLASH_PAGE);
+	} else {
+		pdiStore(PDI_NVM_CMD, PDI_NVMCMD_WRITE_EE_PAGE);
+	}
+	pdiStore(address, 0xFF);
+
+	return pdiNvmWait();
+}
+
+uchar pdiNvmExecute(uchar cmd) {
+	pdiStore(PDI_NVM_CMD, cmd);
+	pdiStore(PDI_NVM_CTRLA, PDI_NVM_CMDEX);
+	return pdiNvmWait();
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * pdi.h - part of USBasp
+ *
+ * Description....: Provides functions for programming ATxmega devices
+ *                  over PDI (PDI_CLK = RST, PDI_DATA = MOSI)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __pdi_h_included__
+#define	__pdi_h_included__
+
+#define PDI_CLK   ISP_RST
+#define PDI_DATA  ISP_MOSI
+
+/* PDI instructions */
+#define PDI_LDS           0x00
+#define PDI_LD            0x20
+#define PDI_STS           0x40
+#define PDI_ST            0x60
+#define PDI_LDCS          0x80
+#define PDI_REPEAT        0xA0
+#define PDI_STCS          0xC0
+#define PDI_KEY           0xE0
+
+/* LD/ST pointer modes and sizes */
+#define PDI_PTR_IND       0x00	/* *(ptr) */
+#define PDI_PTR_INC       0x04	/* *(ptr++) */
+#define PDI_PTR_REG       0x08	/* ptr */
+#define PDI_SIZE_BYTE     0x00
+#define PDI_SIZE_LONG     0x03
+#define PDI_ADDR_LONG     0x0C	/* LDS/STS address size */
+
+/* control/status registers */
+#define PDI_REG_STATUS    0
+#define PDI_REG_RESET     1
+#define PDI_REG_CTRL      2
+
+#define PDI_STATUS_NVMEN  0x02
+#define PDI_RESET_KEY     0x59
+#define PDI_CTRL_GT_8     0x04	/* guard time 8 idle bits */
+
+/* NVM controller in PDI address space */
+#define PDI_DATA_SPACE    0x01000000UL
+#define PDI_NVM_CMD       (PDI_DATA_SPACE + 0x01CA)
+#define PDI_NVM_CTRLA     (PDI_DATA_SPACE + 0x01CB)
+#define PDI_NVM_STATUS    (PDI_DATA_SPACE + 0x01CF)
+#define PDI_NVM_CMDEX     0x01
+#define PDI_NVM_BUSY      0x80
+
+/* NVM commands */
+#define PDI_NVMCMD_NOP              0x00
+#define PDI_NVMCMD_CHIP_ERASE       0x40
+#define PDI_NVMCMD_READ_NVM         0x43
+#define PDI_NVMCMD_LOAD_FLASH_BUF   0x23
+#define PDI_NVMCMD_ERASE_FLASH_BUF  0x26
+#define PDI_NVMCMD_WRITE_FLASH_PAGE 0x2F	/* erase and write */
+#define PDI_NVMCMD_LOAD_EE_BUF      0x33
+#define PDI_NVMCMD_WRITE_EE_PAGE    0x35	/* erase and write */
+#define PDI_NVMCMD_ERASE_EE_BUF     0x36
+
+/* memory types for page writes */
+#define PDI_MEM_RAW       0	/* plain data space access */
+#define PDI_MEM_FLASH     1
+#define PDI_MEM_EEPROM    2
+
+/* timeouts in 320 us units */
+#define PDI_T_NVMEN       32
+#define PDI_T_NVM         255
+
+/* Enable PDI and NVM interface, delay is half clock in 3 cycle units.
+ * Returns 0 on success */
+uchar pdiConnect(uchar delay);
+
+/* Release target from reset and disable PDI */
+void pdiDisconnect();
+
+/* Send idle bits, keeps PDI enabled between requests */
+void pdiSendIdle(uchar bits);
+
+/* Read len bytes from address using one REPEAT LD *(ptr++).
+ * Returns 0 on success */
+uchar pdiReadBlock(unsigned long address, uchar *data, uchar len);
+
+/* Write len bytes to address using one REPEAT ST *(ptr++), return 0 if
+ * target still answers afterwards */
+uchar pdiWriteBlock(unsigned long address, uchar *data, uchar len);
+
+/* Prepare NVM for reading or for loading the page buffer of memtype */
+void pdiNvmStart(uchar memtype, uchar write);
+
+/* Write page buffer of memtype to page at address, wait until done.
+ * Returns 0 on success */
+uchar pdiNvmWritePage(uchar memtype, unsigned long address);
+
+/* Execute NVM command by CMDEX and wait until done.
+ * Returns 0 on success */
+uchar pdiNvmExecute(uchar cmd);
+
+#endif /* __pdi_h_included__ */
@@ -0,0 +1,143 @@
+/*
+ * spiflash.c - part of USBasp
+ *
+ * Description....: Provides functions for programming 25-series SPI NOR
+ *                  flash over ISP interface (RST is chip select)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include "isp.h"
+#include "clock.h"
+#include "spiflash.h"
+
+#ifdef USBASP_SPIFLASH
+
+static uchar spiflash_programming;
+
+static void spiflashAddress(unsigned long address) {
+	ispTransmit(address >> 16);
+	ispTransmit(address >> 8);
+	ispTransmit(address);
+}
+
+static void spiflashWriteEnable() {
+	ispSelectSPI();
+	ispTransmit(SPIFLASH_WREN);
+	ispDeselectSPI();
+}
+
+/* poll WIP, timeout * 320 us */
+static uchar spiflashWaitReady(unsigned int timeout) {
+
+	uchar status;
+	uint8_t starttime = TIMERVALUE;
+
+	ispSelectSPI();
+	ispTransmit(SPIFLASH_RDSR);
+	for (;;) {
+		/* status register is repeated while CS stays low */
+		status = ispTransmit(0);
+		if (!(status & SPIFLASH_SR_WIP) || timeout == 0) {
+			break;
+		}
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			timeout--;
+		}
+	}
+	ispDeselectSPI();
+
+	return status;
+}
+
+void spiflashReadID(uchar *id) {
+	ispSelectSPI();
+	ispTransmit(SPIFLASH_JEDEC_ID);
+	id[0] = ispTransmit(0);
+	id[1] = ispTransmit(0);
+	id[2] = ispTransmit(0);
+	ispDeselectSPI();
+}
+
+void spiflashReadStart(unsigned long address, uchar fast) {
+	ispSelectSPI();
+	if (fast) {
+		ispTransmit(SPIFLASH_FAST_READ);
+		spiflashAddress(address);
+		ispTransmit(0); /* dummy byte */
+	} else {
+		ispTransmit(SPIFLASH_READ);
+		spiflashAddress(address);
+	}
+}
+
+void spiflashReadEnd() {
+	ispDeselectSPI();
+}
+
+uchar spiflashWriteByte(unsigned long address, uchar data) {
+	uchar status = 0;
+
+	/* page program must not wrap around at page end */
+	if (spiflash_programming && (address & 0xFF) == 0) {
+		status = spiflashWriteEnd();
+		if (status & SPIFLASH_SR_WIP) {
+			return status;
+		}
+	}
+
+	if (!spiflash_programming) {
+		spiflashWriteEnable();
+		ispSelectSPI();
+		ispTransmit(SPIFLASH_PP);
+		spiflashAddress(address);
+		spiflash_programming = 1;
+	}
+
+	ispTransmit(data);
+
+	return status;
+}
+
+uchar spiflashWriteEnd() {
+
+	if (!spiflash_programming) {
+		return 0;
+	}
+
+	ispDeselectSPI();
+	spiflash_programming = 0;
+
+	return spiflashWaitReady(SPIFLASH_T_PP);
+}
+
+uchar spiflashErase(uchar instruction, unsigned long address) {
+	uchar status;
+
+	spiflashWriteEnable();
+
+	ispSelectSPI();
+	ispTransmit(instruction);
+	if (instruction == SPIFLASH_CE || instruction == SPIFLASH_CE_ALT) {
+		ispDeselectSPI();
+
+		/* chip erase takes up to minutes, too long to wait within a
+		 * request, host polls status register */
+		ispSelectSPI();
+		ispTransmit(SPIFLASH_RDSR);
+		status = ispTransmit(0);
+		ispDeselectSPI();
+
+		return status;
+	}
+	spiflashAddress(address);
+	ispDeselectSPI();
+
+	return spiflashWaitReady(instruction == SPIFLASH_BE ? SPIFLASH_T_BE
+			: SPIFLASH_T_SE);
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * spiflash.h - part of USBasp
+ *
+ * Description....: Provides functions for programming 25-series SPI NOR
+ *                  flash over ISP interface (RST is chip select)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __spiflash_h_included__
+#define	__spiflash_h_included__
+
+/* SPI flash instructions */
+#define SPIFLASH_WRSR       0x01
+#define SPIFLASH_PP         0x02
+#define SPIFLASH_READ       0x03
+#define SPIFLASH_RDSR       0x05
+#define SPIFLASH_WREN       0x06
+#define SPIFLASH_FAST_READ  0x0B
+#define SPIFLASH_SE         0x20	/* 4 KB sector erase */
+#define SPIFLASH_CE         0x60
+#define SPIFLASH_JEDEC_ID   0x9F
+#define SPIFLASH_CE_ALT     0xC7
+#define SPIFLASH_BE         0xD8	/* 64 KB block erase */
+
+/* status register bits */
+#define SPIFLASH_SR_WIP     0x01
+
+/* timeouts in 320 us units */
+#define SPIFLASH_T_PP       32		/* ~10 ms */
+#define SPIFLASH_T_SE       1250	/* 400 ms */
+#define SPIFLASH_T_BE       6250	/* 2 s */
+
+/* read JEDEC manufacturer and device id (3 bytes) */
+void spiflashReadID(uchar *id);
+
+/* start continuous read at address, data is clocked by ispTransmit(0) */
+void spiflashReadStart(unsigned long address, uchar fast);
+
+/* end continuous read */
+void spiflashReadEnd();
+
+/* program byte, a page program is started or continued as needed,
+ * return status register of page program ended before (WIP set if it
+ * timed out, byte is not programmed then) */
+uchar spiflashWriteByte(unsigned long address, uchar data);
+
+/* end page program and wait until done, return status register */
+uchar spiflashWriteEnd();
+
+/* erase sector/block at address and wait until done, or start erase of
+ * whole chip without waiting, return status register (WIP set while
+ * erasing or on timeout) */
+uchar spiflashErase(uchar instruction, unsigned long address);
+
+#endif /* __spiflash_h_included__ */
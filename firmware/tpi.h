@@ -9,8 +9,14 @@
 
 
 /* Globals */
-/** Number of iterations in tpi_delay loop */
+/** Number of iterations in tpi_delay loop, 0 = unrolled code without delay */
 extern uint16_t tpi_dly_cnt;
+/** Number of idle bits tpi_recv_byte waits for start bit */
+extern uint8_t tpi_recv_timeout;
+/** Nonzero if PR of target is known, clear if PR is changed by others */
+extern uint8_t tpi_pr_valid;
+/** Number of tpi_recv_byte calls without start bit */
+extern uint16_t tpi_recv_timeouts;
 
 
 /* Functions */
@@ -18,6 +24,11 @@ extern uint16_t tpi_dly_cnt;
  * TPI init
  */
 void tpi_init(void);
+/**
+ * Send idle bits by TPI
+ * \param bits Number of bits
+ */
+void tpi_send_idle(uint8_t bits);
 /**
  * Send raw byte by TPI
  * \param b Byte to send
@@ -42,6 +53,12 @@ void tpi_read_block(uint16_t addr, uint8_t* dptr, uint8_t len);
  * \param len Length of write
  */
 void tpi_write_block(uint16_t addr, const uint8_t* sptr, uint8_t len);
+/**
+ * Wait until NVM controller is not busy
+ * \param timeout Timeout in 320 us units, 0 = 256
+ * \return TPI_NVM_READY, TPI_NVM_BUSY or TPI_NVM_NORESPONSE
+ */
+uint8_t tpi_nvm_wait(uint8_t timeout);
 
 
 #endif /*__TPI_H__*/
@@ -23,6 +23,9 @@
 #define TPIPCR 0x2
 #define TPISR  0x0
 
+// TPIIR value of all TPI devices
+#define TPIIR_ID       0x80
+
 // TPIPCR bits
 #define TPIPCR_GT_2    0x04
 #define TPIPCR_GT_1    0x02
@@ -36,6 +39,14 @@
 #define TPIPCR_GT_2b   0x06
 #define TPIPCR_GT_0b   0x07
 
+// idle bits before start bit of response
+#define TPI_GUARD_BITS(gt) ((gt) == TPIPCR_GT_0b ? 0 : (128 >> (gt)))
+#define TPI_RECV_TIMEOUT(gt) (TPI_GUARD_BITS(gt) + 32)
+#define TPI_RECV_TIMEOUT_DEFAULT 192
+
+// idle bits timed by USBASP_FUNC_TPI_CALIBRATE
+#define TPI_CALIBRATE_BITS 32
+
 // TPISR bits
 #define TPISR_NVMEN    0x02
 
@@ -52,6 +63,19 @@
 #define NVMCMD_SECTION_ERASE 0x14
 #define NVMCMD_WORD_WRITE    0x1D
 
+// tpi_nvm_wait timeout in 320 us units and results
+#define TPI_NVM_TIMEOUT      250	/* 80 ms */
+#define TPI_NVM_READY        0
+#define TPI_NVM_BUSY         1	/* BSY still set after timeout */
+#define TPI_NVM_NORESPONSE   2	/* no start bit from target */
+
+/* NVM locations */
+#define TPI_LOCK_ADDR        0x3F00
+#define TPI_CONFIG_ADDR      0x3F40
+#define TPI_CALIB_ADDR       0x3F80
+#define TPI_SIGNATURE_ADDR   0x3FC0
+#define TPI_FLASH_ADDR       0x4000
+
 
 
 
@@ -0,0 +1,102 @@
+/*
+ * trace.c - part of USBasp
+ *
+ * Description....: Optional event trace with timestamps in a ring
+ *                  buffer, enabled by defining USBASP_TRACE
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "clock.h"
+#include "trace.h"
+
+#ifdef USBASP_TRACE
+
+#define TRACE_BYTES  (TRACE_SIZE * TRACE_ENTRY_SIZE)
+
+static uchar trace_buffer[TRACE_BYTES];
+static uchar trace_head, trace_tail;
+static uchar trace_lost;
+static uchar trace_request;
+static volatile uchar trace_time_high;
+
+/* extends TCNT0, interrupts stay enabled for USB */
+ISR(TIMER0_OVF_vect, ISR_NOBLOCK) {
+	trace_time_high++;
+}
+
+void traceInit() {
+	TIMSK0 |= (1 << TOIE0);
+}
+
+static unsigned int traceTime() {
+	uchar high, low;
+
+	/* overflow may happen between reads */
+	do {
+		high = trace_time_high;
+		low = TIMERVALUE;
+	} while (high != trace_time_high);
+
+	return (high << 8) | low;
+}
+
+static uchar traceFree() {
+	return (trace_tail - trace_head - TRACE_ENTRY_SIZE) & (TRACE_BYTES - 1);
+}
+
+static void traceStore(uchar event, uchar arg) {
+	unsigned int time = traceTime();
+
+	trace_buffer[trace_head] = event;
+	trace_buffer[trace_head + 1] = arg;
+	trace_buffer[trace_head + 2] = time;
+	trace_buffer[trace_head + 3] = time >> 8;
+	trace_head = (trace_head + TRACE_ENTRY_SIZE) & (TRACE_BYTES - 1);
+}
+
+void traceEvent(uchar event, uchar arg) {
+
+	/* report dropped events once there is room again */
+	if (trace_lost && traceFree() >= 2 * TRACE_ENTRY_SIZE) {
+		traceStore(TRACE_LOST, trace_lost);
+		trace_lost = 0;
+	}
+
+	if (!trace_lost && traceFree() >= TRACE_ENTRY_SIZE) {
+		traceStore(event, arg);
+	} else if (trace_lost != 255) {
+		trace_lost++;
+	}
+}
+
+void traceRequest(uchar id) {
+	traceRequestEnd();
+	traceEvent(TRACE_REQUEST_START, id);
+	trace_request = id;
+}
+
+void traceRequestEnd() {
+	if (trace_request) {
+		traceEvent(TRACE_REQUEST_END, trace_request);
+		trace_request = 0;
+	}
+}
+
+uchar traceRead(uchar *data, uchar len) {
+	uchar i;
+
+	/* whole entries only */
+	len &= ~(TRACE_ENTRY_SIZE - 1);
+	for (i = 0; i < len && trace_tail != trace_head; i++) {
+		data[i] = trace_buffer[trace_tail];
+		trace_tail = (trace_tail + 1) & (TRACE_BYTES - 1);
+	}
+
+	return i;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * trace.h - part of USBasp
+ *
+ * Description....: Optional event trace with timestamps in a ring
+ *                  buffer, enabled by defining USBASP_TRACE
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __trace_h_included__
+#define	__trace_h_included__
+
+#ifndef uchar
+#define	uchar	unsigned char
+#endif
+
+/* Entries are four bytes: event, argument and 16 bit timestamp in timer
+ * ticks (5.33 us), which wraps after 350 ms */
+#define TRACE_ENTRY_SIZE      4
+
+/* ring buffer size in entries, must be a power of two */
+#define TRACE_SIZE            32
+
+/* events and their argument */
+#define TRACE_REQUEST_START   0x01	/* function ID */
+#define TRACE_REQUEST_END     0x02	/* function ID */
+#define TRACE_FLUSH_BEGIN     0x03
+#define TRACE_FLUSH_END       0x04	/* 0 = ok, 1 = timeout */
+#define TRACE_POLL_EXIT       0x05	/* 0 = ready, 1 = timeout */
+#define TRACE_SCK             0x06	/* SCK option */
+#define TRACE_LOST            0x07	/* events dropped, buffer was full */
+
+#ifdef USBASP_TRACE
+
+/* Start timestamp timer extension */
+void traceInit();
+
+/* Record event */
+void traceEvent(uchar event, uchar arg);
+
+/* Record start of request, ends a request still open */
+void traceRequest(uchar id);
+
+/* Record end of open request */
+void traceRequestEnd();
+
+/* Copy up to len bytes of complete entries, return count */
+uchar traceRead(uchar *data, uchar len);
+
+#else
+
+#define traceInit()
+#define traceEvent(event, arg)
+#define traceRequest(id)
+#define traceRequestEnd()
+#define traceRead(data, len)  0
+
+#endif
+
+#endif /* __trace_h_included__ */
@@ -0,0 +1,185 @@
+/*
+ * uart.c - part of USBasp
+ *
+ * Description....: Provides a buffered serial bridge to the target,
+ *                  using the hardware USART (RxD/TxD on ISP connector)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "clock.h"
+#include "usbasp.h"
+#include "uart.h"
+
+#ifdef USBASP_UART
+
+#define UART_RX_ON   ((1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0))
+#define UART_RX_OFF  ((1 << RXEN0) | (1 << TXEN0))
+
+/* receive ring buffer, written by interrupt */
+uchar uart_rx_buffer[UART_RX_SIZE];
+volatile uchar uart_rx_head;
+uchar uart_rx_tail;
+volatile uchar uart_rx_status;	/* DOR and FE bits of UCSR0A */
+
+static uchar uart_tx_buffer[UART_TX_SIZE];
+static uchar uart_tx_head, uart_tx_tail;
+
+/* Store received byte in ring buffer, a full buffer drops it. USB allows
+ * no more than 25 cycles interrupt latency, so the own interrupt is masked
+ * without touching SREG and interrupts are enabled right away */
+ISR(USART_RX_vect, ISR_NAKED) {
+	asm volatile (
+		"push r24\n\t"
+		"ldi r24, %[off]\n\t"
+		"sts %[ucsrb], r24\n\t"
+		"sei\n\t"
+		"in r24, __SREG__\n\t"
+		"push r24\n\t"
+		"push r23\n\t"
+		"push r25\n\t"
+		"push r30\n\t"
+		"push r31\n\t"
+		"lds r25, %[ucsra]\n\t"	/* status is valid before UDR read */
+		"lds r24, %[udr]\n\t"
+		"andi r25, %[errors]\n\t"
+		"lds r30, uart_rx_head\n\t"
+		"mov r23, r30\n\t"
+		"inc r23\n\t"
+		"andi r23, %[mask]\n\t"
+		"lds r31, uart_rx_tail\n\t"
+		"cp r23, r31\n\t"
+		"brne 1f\n\t"
+		"ori r25, %[dor]\n\t"
+		"rjmp 2f\n"
+		"1:\n\t"
+		"ldi r31, 0\n\t"
+		"subi r30, lo8(-(uart_rx_buffer))\n\t"
+		"sbci r31, hi8(-(uart_rx_buffer))\n\t"
+		"st Z, r24\n\t"
+		"sts uart_rx_head, r23\n"
+		"2:\n\t"
+		"lds r24, uart_rx_status\n\t"
+		"or r24, r25\n\t"
+		"sts uart_rx_status, r24\n\t"
+		"cli\n\t"
+		"ldi r24, %[on]\n\t"
+		"sts %[ucsrb], r24\n\t"
+		"pop r31\n\t"
+		"pop r30\n\t"
+		"pop r25\n\t"
+		"pop r23\n\t"
+		"pop r24\n\t"
+		"andi r24, 0x7F\n\t"	/* interrupts stay off until reti */
+		"out __SREG__, r24\n\t"
+		"pop r24\n\t"
+		"reti\n\t"
+		::
+		[ucsra] "n" (_SFR_MEM_ADDR(UCSR0A)),
+		[ucsrb] "n" (_SFR_MEM_ADDR(UCSR0B)),
+		[udr] "n" (_SFR_MEM_ADDR(UDR0)),
+		[on] "M" (UART_RX_ON),
+		[off] "M" (UART_RX_OFF),
+		[errors] "M" ((1 << DOR0) | (1 << FE0)),
+		[dor] "M" (1 << DOR0),
+		[mask] "M" (UART_RX_SIZE - 1)
+	);
+}
+
+unsigned int uartConnect(unsigned long baud) {
+
+	unsigned int ubrr;
+
+	UCSR0B = 0;
+	uart_rx_head = uart_rx_tail = 0;
+	uart_tx_head = uart_tx_tail = 0;
+	uart_rx_status = 0;
+
+	if (baud < UART_BAUD_MIN) {
+		baud = UART_BAUD_MIN;
+	} else if (baud > UART_BAUD_MAX) {
+		baud = UART_BAUD_MAX;
+	}
+
+	/* prefer double speed for finer steps at high baud rates */
+	if (baud > F_CPU / 8 / 4096) {
+		ubrr = ((F_CPU / 4 / baud) + 1) / 2 - 1;
+		UCSR0A = (1 << U2X0);
+	} else {
+		ubrr = ((F_CPU / 8 / baud) + 1) / 2 - 1;
+		UCSR0A = 0;
+	}
+	UBRR0H = ubrr >> 8;
+	UBRR0L = ubrr;
+
+	/* 8N1 */
+	UCSR0C = UART_URSEL | (1 << UCSZ01) | (1 << UCSZ00);
+	UCSR0B = UART_RX_ON;
+
+	if (UCSR0A & (1 << U2X0)) {
+		ubrr |= 0x8000;
+	}
+	return ubrr;
+}
+
+void uartDisconnect() {
+	/* pins fall back to port settings */
+	UCSR0B = 0;
+}
+
+void uartPoll() {
+
+	if ((uart_tx_tail != uart_tx_head) && (UCSR0A & (1 << UDRE0))) {
+		UDR0 = uart_tx_buffer[uart_tx_tail];
+		uart_tx_tail = (uart_tx_tail + 1) & (UART_TX_SIZE - 1);
+	}
+}
+
+uchar uartStatus() {
+
+	uchar status = 0;
+
+	cli();
+	if (uart_rx_status & (1 << DOR0)) {
+		status |= USBASP_UART_OVERRUN;
+	}
+	if (uart_rx_status & (1 << FE0)) {
+		status |= USBASP_UART_FRAME;
+	}
+	uart_rx_status = 0;
+	sei();
+
+	return status;
+}
+
+uchar uartRead(uchar *data, uchar len) {
+
+	uchar i;
+
+	for (i = 0; i < len && uart_rx_tail != uart_rx_head; i++) {
+		data[i] = uart_rx_buffer[uart_rx_tail];
+		uart_rx_tail = (uart_rx_tail + 1) & (UART_RX_SIZE - 1);
+	}
+
+	return i;
+}
+
+void uartWrite(uchar *data, uchar len) {
+
+	uchar i, next;
+
+	for (i = 0; i < len; i++) {
+		next = (uart_tx_head + 1) & (UART_TX_SIZE - 1);
+		while (next == uart_tx_tail) {
+			/* wait for space */
+			uartPoll();
+		}
+		uart_tx_buffer[uart_tx_head] = data[i];
+		uart_tx_head = next;
+	}
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * uart.h - part of USBasp
+ *
+ * Description....: Provides a buffered serial bridge to the target,
+ *                  using the hardware USART (RxD/TxD on ISP connector)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __uart_h_included__
+#define	__uart_h_included__
+
+#ifndef uchar
+#define	uchar	unsigned char
+#endif
+
+/* ATmega48/88 register names, shared with UPDI */
+#ifdef __AVR_ATmega8__
+#define UCSR0A  UCSRA
+#define UCSR0B  UCSRB
+#define UCSR0C  UCSRC
+#define UBRR0H  UBRRH
+#define UBRR0L  UBRRL
+#define UDR0    UDR
+#define RXC0    RXC
+#define UDRE0   UDRE
+#define FE0     FE
+#define DOR0    DOR
+#define UPE0    PE
+#define U2X0    U2X
+#define RXCIE0  RXCIE
+#define RXEN0   RXEN
+#define TXEN0   TXEN
+#define UCSZ00  UCSZ0
+#define UCSZ01  UCSZ1
+#define UPM01   UPM1
+#define USBS0   USBS
+#define UART_URSEL      (1 << URSEL)
+#define USART_RX_vect   USART_RXC_vect
+#else
+#define UART_URSEL      0
+#endif
+
+/* ring buffer sizes, must be powers of two */
+#define UART_RX_SIZE   128
+#define UART_TX_SIZE   64
+
+/* baud rate limits of UBRR with and without U2X */
+#define UART_BAUD_MIN  (F_CPU / 16 / 4096 + 1)
+#define UART_BAUD_MAX  (F_CPU / 8)
+
+/* Enable USART with given baud rate, returns UBRR (bit 15 set if U2X) */
+unsigned int uartConnect(unsigned long baud);
+
+/* Disable USART */
+void uartDisconnect();
+
+/* Move data from ring buffer to USART, call from main loop. Received
+ * bytes are stored by interrupt */
+void uartPoll();
+
+/* Return and clear receive status (USBASP_UART_OVERRUN/FRAME) */
+uchar uartStatus();
+
+/* Copy up to len received bytes to data, return count */
+uchar uartRead(uchar *data, uchar len);
+
+/* Queue len bytes for sending, waits while transmit buffer is full */
+void uartWrite(uchar *data, uchar len);
+
+#endif /* __uart_h_included__ */
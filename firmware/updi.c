@@ -0,0 +1,294 @@
+/*
+ * updi.c - part of USBasp
+ *
+ * Description....: Provides functions for UPDI devices over the USART,
+ *                  RxD connected to UPDI, TxD through ~4k7 resistor.
+ *                  Memory access works on all devices, page programming
+ *                  on NVMCTRL v0 (tinyAVR 0/1/2, megaAVR 0) only
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#include <avr/io.h>
+#include "clock.h"
+#include "uart.h"
+#include "updi.h"
+
+#ifdef USBASP_UPDI
+
+static uchar updi_nvm_version;
+static unsigned int updi_recv_timeout = UPDI_T_RECV;
+static uchar updi_break_time = UPDI_T_BREAK;
+
+static uchar updiRecv(uchar *b) {
+	unsigned int timeout = updi_recv_timeout;
+	uint8_t starttime = TIMERVALUE;
+
+	while (!(UCSR0A & (1 << RXC0))) {
+		if ((uint8_t) (TIMERVALUE - starttime) > CLOCK_T_320us) {
+			starttime = TIMERVALUE;
+			if (--timeout == 0) {
+				return 1; /* error */
+			}
+		}
+	}
+
+	/* lost bytes leave the echo check out of step */
+	if (UCSR0A & ((1 << FE0) | (1 << DOR0) | (1 << UPE0))) {
+		*b = UDR0;
+		return 1;
+	}
+	*b = UDR0;
+	return 0;
+}
+
+/* send byte, TxD and RxD share the line, so every byte comes back */
+static uchar updiSend(uchar b) {
+	uchar echo;
+
+	while (!(UCSR0A & (1 << UDRE0)))
+		;
+	UDR0 = b;
+
+	return updiRecv(&echo) || echo != b;
+}
+
+/* break resets UPDI, longer than 12 bits at connect baud rate */
+static void updiBreak() {
+	uchar ucsrb = UCSR0B;
+
+	UCSR0B = 0;
+	PORTD &= ~(1 << PD1);
+	DDRD |= (1 << PD1);
+	clockWait(updi_break_time);
+	PORTD |= (1 << PD1);
+	clockWait(1);
+	UCSR0B = ucsrb;
+}
+
+static uchar updiStoreCS(uchar reg, uchar b) {
+	updiSend(UPDI_SYNCH);
+	updiSend(UPDI_STCS | reg);
+	return updiSend(b);
+}
+
+static uchar updiLoadCS(uchar reg, uchar *b) {
+	updiSend(UPDI_SYNCH);
+	updiSend(UPDI_LDCS | reg);
+	return updiRecv(b);
+}
+
+/* address size follows address, 24 bit only where needed (AVR Dx) */
+static uchar updiSendAddress(uchar instruction, unsigned long address) {
+	uchar error;
+
+	updiSend(UPDI_SYNCH);
+	if (address >> 16) {
+		updiSend(instruction | UPDI_ADDR_24);
+		updiSend(address);
+		updiSend(address >> 8);
+		error = updiSend(address >> 16);
+	} else {
+		updiSend(instruction | UPDI_ADDR_16);
+		updiSend(address);
+		error = updiSend(address >> 8);
+	}
+	return error;
+}
+
+static uchar updiLoad(unsigned long address, uchar *b) {
+	updiSendAddress(UPDI_LDS, address);
+	return updiRecv(b);
+}
+
+static uchar updiStore(unsigned long address, uchar b) {
+	uchar ack;
+
+	updiSendAddress(UPDI_STS, address);
+	if (updiRecv(&ack) || ack != UPDI_ACK) {
+		return 1;
+	}
+	updiSend(b);
+	return updiRecv(&ack) || ack != UPDI_ACK;
+}
+
+/* set pointer register for burst access */
+static uchar updiSetPointer(unsigned long address) {
+	uchar ack;
+
+	updiSend(UPDI_SYNCH);
+	if (address >> 16) {
+		updiSend(UPDI_ST | UPDI_PTR_REG | UPDI_DATA_24);
+		updiSend(address);
+		updiSend(address >> 8);
+		updiSend(address >> 16);
+	} else {
+		updiSend(UPDI_ST | UPDI_PTR_REG | UPDI_DATA_16);
+		updiSend(address);
+		updiSend(address >> 8);
+	}
+	return updiRecv(&ack) || ack != UPDI_ACK;
+}
+
+/* repeat following instruction len times */
+static void updiRepeat(uchar len) {
+	updiSend(UPDI_SYNCH);
+	updiSend(UPDI_REPEAT);
+	updiSend(len - 1);
+}
+
+uchar updiConnect(unsigned long baud, uchar nvmprog) {
+	uchar i, status;
+	uchar sib[UPDI_SIB_SIZE];
+	uchar timeout = UPDI_T_NVMPROG;
+	static const uchar key[8] = { 0x20, 0x67, 0x6F, 0x72, 0x50, 0x4D, 0x56,
+			0x4E }; /* "NVMProg ", LSB first */
+
+	/* 8E2 on the bridge USART, frames take longer at low baud rates,
+	 * a bit is 1000000 / 320 / baud = 3125 / baud timeout units */
+	if (baud < UART_BAUD_MIN) {
+		baud = UART_BAUD_MIN;
+	}
+	updi_recv_timeout = UPDI_T_RECV
+			+ (UPDI_RECV_BITS * 3125UL + baud - 1) / baud;
+	updi_break_time = UPDI_T_BREAK;
+	if (12 * 3125UL / baud >= UPDI_T_BREAK) {
+		updi_break_time = 12 * 3125UL / baud + 1;
+	}
+	uartConnect(baud);
+	UCSR0B = (1 << RXEN0) | (1 << TXEN0); /* polled, no bridge interrupt */
+	UCSR0C = UART_URSEL | (1 << UPM01) | (1 << USBS0) | (1 << UCSZ01)
+			| (1 << UCSZ00);
+	updi_nvm_version = 0xFF;
+
+	/* double break: enable or reset UPDI from any state */
+	updiBreak();
+	updiBreak();
+
+	updiStoreCS(UPDI_CS_CTRLB, UPDI_CTRLB_CCDETDIS);
+	updiStoreCS(UPDI_CS_CTRLA, UPDI_CTRLA_IBDLY | UPDI_CTRLA_GT_8);
+
+	if (updiLoadCS(UPDI_CS_STATUSA, &status) || status == 0) {
+		return 1; /* no response */
+	}
+
+	/* NVM controller version from system information block ("P:0") */
+	updiSend(UPDI_SYNCH);
+	updiSend(UPDI_KEY | UPDI_KEY_SIB | UPDI_KEY_SIZE_128);
+	for (i = 0; i < UPDI_SIB_SIZE; i++) {
+		if (updiRecv(&sib[i])) {
+			return 1;
+		}
+	}
+	updi_nvm_version = sib[UPDI_SIB_NVM_VERSION] - '0';
+
+	if (!nvmprog) {
+		return 0;
+	}
+
+	updiSend(UPDI_SYNCH);
+	updiSend(UPDI_KEY);
+	for (i = 0; i < 8; i++) {
+		updiSend(key[i]);
+	}
+	if (updiLoadCS(UPDI_ASI_KEY_STATUS, &status)
+			|| !(status & UPDI_KEY_NVMPROG)) {
+		return 2; /* key not accepted */
+	}
+
+	/* key takes effect on reset */
+	updiStoreCS(UPDI_ASI_RESET_REQ, UPDI_RESET_KEY);
+	updiStoreCS(UPDI_ASI_RESET_REQ, 0);
+
+	for (;;) {
+		if (updiLoadCS(UPDI_ASI_SYS_STATUS, &status) == 0
+				&& (status & UPDI_SYS_NVMPROG)) {
+			return 0;
+		}
+		clockWait(1);
+		if (--timeout == 0) {
+			return 3; /* not in programming mode */
+		}
+	}
+}
+
+uchar updiNvmVersion() {
+	return updi_nvm_version;
+}
+
+void updiDisconnect() {
+	updiStoreCS(UPDI_ASI_RESET_REQ, UPDI_RESET_KEY);
+	updiStoreCS(UPDI_ASI_RESET_REQ, 0);
+	updiStoreCS(UPDI_CS_CTRLB, UPDI_CTRLB_UPDIDIS);
+	uartDisconnect();
+}
+
+uchar updiReadBlock(unsigned long address, uchar *data, uchar len) {
+	uchar i, error;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	if (updiSetPointer(address)) {
+		return 1;
+	}
+	updiRepeat(len);
+	updiSend(UPDI_SYNCH);
+	error = updiSend(UPDI_LD | UPDI_PTR_INC);
+
+	for (i = 0; i < len; i++) {
+		error |= updiRecv(&data[i]);
+	}
+
+	return error;
+}
+
+uchar updiWriteBlock(unsigned long address, uchar *data, uchar len) {
+	uchar i, error;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	if (updiSetPointer(address)) {
+		return 1;
+	}
+
+	/* no ACK per byte during burst */
+	updiStoreCS(UPDI_CS_CTRLA, UPDI_CTRLA_IBDLY | UPDI_CTRLA_GT_8
+			| UPDI_CTRLA_RSD);
+	updiRepeat(len);
+	updiSend(UPDI_SYNCH);
+	error = updiSend(UPDI_ST | UPDI_PTR_INC);
+	for (i = 0; i < len; i++) {
+		error |= updiSend(data[i]);
+	}
+	updiStoreCS(UPDI_CS_CTRLA, UPDI_CTRLA_IBDLY | UPDI_CTRLA_GT_8);
+
+	return error;
+}
+
+uchar updiNvmCommand(uchar cmd) {
+	uchar timeout = UPDI_T_NVM;
+	uchar status;
+
+	if (updiStore(UPDI_NVM_CTRLA, cmd)) {
+		return 1;
+	}
+
+	/* poll busy flags on the device */
+	for (;;) {
+		if (updiLoad(UPDI_NVM_STATUS, &status) == 0
+				&& !(status & UPDI_NVM_BUSY)) {
+			return 0;
+		}
+		clockWait(1);
+		if (--timeout == 0) {
+			return 1; /* error */
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * updi.h - part of USBasp
+ *
+ * Description....: Provides functions for UPDI devices over the USART,
+ *                  RxD connected to UPDI, TxD through ~4k7 resistor.
+ *                  Memory access works on all devices, page programming
+ *                  on NVMCTRL v0 (tinyAVR 0/1/2, megaAVR 0) only
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ * Creation Date..: 2026-10-19
+ * Last change....: 2026-10-19
+ */
+
+#ifndef __updi_h_included__
+#define	__updi_h_included__
+
+/* UPDI instructions */
+#define UPDI_SYNCH        0x55
+#define UPDI_ACK          0x40
+#define UPDI_LDS          0x00
+#define UPDI_STS          0x40
+#define UPDI_LD           0x20
+#define UPDI_ST           0x60
+#define UPDI_LDCS         0x80
+#define UPDI_STCS         0xC0
+#define UPDI_REPEAT       0xA0
+#define UPDI_KEY          0xE0
+#define UPDI_KEY_SIB      0x04	/* receive system information block */
+#define UPDI_KEY_SIZE_128 0x01
+
+/* LD/ST pointer modes, address and data sizes */
+#define UPDI_PTR_INC      0x04	/* *(ptr++) */
+#define UPDI_PTR_REG      0x08	/* ptr */
+#define UPDI_ADDR_16      0x04	/* LDS/STS address size */
+#define UPDI_ADDR_24      0x08
+#define UPDI_DATA_16      0x01	/* ST ptr size */
+#define UPDI_DATA_24      0x02
+
+/* control/status registers */
+#define UPDI_CS_STATUSA   0x00
+#define UPDI_CS_CTRLA     0x02
+#define UPDI_CS_CTRLB     0x03
+#define UPDI_ASI_KEY_STATUS 0x07
+#define UPDI_ASI_RESET_REQ  0x08
+#define UPDI_ASI_SYS_STATUS 0x0B
+
+#define UPDI_CTRLA_IBDLY  0x80
+#define UPDI_CTRLA_RSD    0x08	/* no ACK after ST */
+#define UPDI_CTRLA_GT_8   0x04	/* guard time 8 bits */
+#define UPDI_CTRLB_UPDIDIS 0x04
+#define UPDI_CTRLB_CCDETDIS 0x08
+#define UPDI_KEY_NVMPROG  0x10
+#define UPDI_SYS_NVMPROG  0x08
+#define UPDI_RESET_KEY    0x59
+
+/* system information block, e.g. "tinyAVR P:0D:0-3" */
+#define UPDI_SIB_SIZE     16
+#define UPDI_SIB_NVM_VERSION 10
+
+/* NVM controller */
+#define UPDI_NVM_CTRLA    0x1000
+#define UPDI_NVM_STATUS   0x1002
+#define UPDI_NVM_BUSY     0x03	/* flash and EEPROM busy */
+#define UPDI_NVMCMD_PBC   0x04	/* page buffer clear, NVMCTRL v0 */
+
+/* timeouts in 320 us units, receive timeout is extended by
+ * UPDI_RECV_BITS bit times at the connect baud rate */
+#define UPDI_T_RECV       8
+#define UPDI_RECV_BITS    32	/* frame, guard time and inter byte delay */
+#define UPDI_T_BREAK      80	/* at least, 12 bit times at low baud rates */
+#define UPDI_T_NVMPROG    64
+#define UPDI_T_NVM        255
+
+/* Reset and enable UPDI, enter NVM programming if nvmprog is set.
+ * Returns 0 on success */
+uchar updiConnect(unsigned long baud, uchar nvmprog);
+
+/* NVMCTRL version read by updiConnect(), 0xFF if unknown. Version 0 loads
+ * the page buffer before the write command, others (AVR Dx: version 2)
+ * are not supported for page writes */
+uchar updiNvmVersion();
+
+/* Release reset and disable UPDI */
+void updiDisconnect();
+
+/* Read len bytes from address with one REPEAT LD *(ptr++).
+ * Returns 0 on success */
+uchar updiReadBlock(unsigned long address, uchar *data, uchar len);
+
+/* Write len bytes to address with one REPEAT ST *(ptr++).
+ * Returns 0 on success */
+uchar updiWriteBlock(unsigned long address, uchar *data, uchar len);
+
+/* Write NVM controller command and wait while busy.
+ * Returns 0 on success */
+uchar updiNvmCommand(uchar cmd);
+
+#endif /* __updi_h_included__ */
@@ -11,6 +11,14 @@
 #ifndef USBASP_H_
 #define USBASP_H_
 
+/* optional engines are selected by FEATURES in Makefile */
+#if defined(USBASP_SPIFLASH) && !defined(USBASP_SPI)
+#error "USBASP_SPIFLASH needs USBASP_SPI (SPI flash uses SPI connect)"
+#endif
+#if defined(USBASP_UPDI) && !defined(USBASP_UART)
+#error "USBASP_UPDI needs USBASP_UART (UPDI runs on the USART)"
+#endif
+
 /* USB function call identifiers */
 #define USBASP_FUNC_CONNECT     1
 #define USBASP_FUNC_DISCONNECT  2
@@ -28,10 +36,155 @@
 #define USBASP_FUNC_TPI_RAWWRITE     14
 #define USBASP_FUNC_TPI_READBLOCK    15
 #define USBASP_FUNC_TPI_WRITEBLOCK   16
+#define USBASP_FUNC_IDENTIFY         17
+#define USBASP_FUNC_SETPROFILE       18
+#define USBASP_FUNC_SWITCHISPSCK     19
+#define USBASP_FUNC_SETTINGS         20
+#define USBASP_FUNC_TPI_CALIBRATE    21
+#define USBASP_FUNC_TPI_SCRIPT       22
+#define USBASP_FUNC_TPI_SCRIPT_RESULT 23
+#define USBASP_FUNC_TPI_CHIPERASE    24
+#define USBASP_FUNC_TPI_SECTIONERASE 25
+#define USBASP_FUNC_TPI_WRITECONFIG  26
+#define USBASP_FUNC_SPI_CONNECT      27
+#define USBASP_FUNC_SPI_TRANSFER     28
+#define USBASP_FUNC_SPI_RESULT       29
+#define USBASP_FUNC_SPIFLASH_ID      30
+#define USBASP_FUNC_SPIFLASH_READ    31
+#define USBASP_FUNC_SPIFLASH_WRITE   32
+#define USBASP_FUNC_SPIFLASH_ERASE   33
+#define USBASP_FUNC_I2C_CONNECT      34
+#define USBASP_FUNC_I2C_READ         35
+#define USBASP_FUNC_I2C_WRITE        36
+#define USBASP_FUNC_UART_CONNECT     37
+#define USBASP_FUNC_UART_READ        38
+#define USBASP_FUNC_UART_WRITE       39
+#define USBASP_FUNC_PDI_CONNECT      40
+#define USBASP_FUNC_PDI_READ         41
+#define USBASP_FUNC_PDI_WRITE        42
+#define USBASP_FUNC_PDI_NVMCMD       43
+#define USBASP_FUNC_UPDI_CONNECT     44
+#define USBASP_FUNC_UPDI_READ        45
+#define USBASP_FUNC_UPDI_WRITE       46
+#define USBASP_FUNC_UPDI_NVMCMD      47
+#define USBASP_FUNC_JTAG_CONNECT     48
+#define USBASP_FUNC_JTAG_COMMAND     49
+#define USBASP_FUNC_JTAG_READFLASH   50
+#define USBASP_FUNC_JTAG_WRITEFLASH  51
+#define USBASP_FUNC_DW_CONNECT       52
+#define USBASP_FUNC_DW_READ          53
+#define USBASP_FUNC_DW_DISABLE       54
+#define USBASP_FUNC_DW_RESULT        55
+#define USBASP_FUNC_CAPTURE_START    56
+#define USBASP_FUNC_CAPTURE_READ     57
+#define USBASP_FUNC_CAPTURE_STOP     58
+#define USBASP_FUNC_MACRO_STORE      59
+#define USBASP_FUNC_MACRO_RUN        60
+#define USBASP_FUNC_COUNTERS         61
+#define USBASP_FUNC_TRACE_READ       62
 #define USBASP_FUNC_GETCAPABILITIES 127
 
 /* USBASP capabilities */
 #define USBASP_CAP_0_TPI    0x01
+#define USBASP_CAP_0_IDENTIFY 0x02
+#define USBASP_CAP_0_PROFILE  0x04
+#define USBASP_CAP_0_SWITCHSCK 0x08
+#define USBASP_CAP_0_SETTINGS 0x10
+#define USBASP_CAP_0_TPI_GUARDTIME 0x20
+#define USBASP_CAP_0_TPI_FAST 0x40
+#define USBASP_CAP_0_TPI_SCRIPT 0x80
+#define USBASP_CAP_1_TPI_NVMOPS 0x01
+#define USBASP_CAP_1_SPI        0x02
+#define USBASP_CAP_1_SPIFLASH   0x04
+#define USBASP_CAP_1_I2C        0x08
+#define USBASP_CAP_1_UART       0x10
+#define USBASP_CAP_1_PDI        0x20
+#define USBASP_CAP_1_UPDI       0x40
+#define USBASP_CAP_1_JTAG       0x80
+#define USBASP_CAP_2_DW         0x01
+#define USBASP_CAP_2_CAPTURE    0x02
+#define USBASP_CAP_2_MACRO      0x04
+#define USBASP_CAP_2_COUNTERS   0x08
+#define USBASP_CAP_2_TRACE      0x10
+
+/* USBASP_FUNC_TPI_CONNECT options */
+#define USBASP_TPI_CONNECT_GUARDTIME 0x01  /* negotiate shortest guard time */
+
+/* USBASP_FUNC_TPI_SCRIPT operations, low bits are byte count. The data
+ * stage stalls if the sequence is longer than PROG_BUFFER_SIZE, malformed,
+ * receives more than TPI_SCRIPT_RESULT_SIZE bytes or an NVMWAIT fails */
+#define TPI_SCRIPT_SEND         0x00  /* send count bytes following */
+#define TPI_SCRIPT_RECV         0x40  /* receive count bytes */
+#define TPI_SCRIPT_NVMWAIT      0x80  /* poll NVMCSR until BSY clears,
+                                         count: timeout in 1.28 ms units,
+                                         0 = TPI_NVM_TIMEOUT */
+#define TPI_SCRIPT_COUNT        0x3F
+
+#define TPI_SCRIPT_RESULT_SIZE  32
+
+/* USBASP_FUNC_TPI_CHIPERASE, _SECTIONERASE and _WRITECONFIG reply one
+ * status byte: TPI_NVM_READY, TPI_NVM_BUSY or TPI_NVM_NORESPONSE
+ * (see tpi_defs.h) */
+
+/* USBASP_FUNC_SPI_TRANSFER chip select (RST) handling */
+#define USBASP_SPI_CS_ASSERT    0x01  /* pull RST low before transfer */
+#define USBASP_SPI_CS_RELEASE   0x02  /* release RST after transfer */
+
+/* USBASP_FUNC_SPIFLASH_READ options */
+#define USBASP_SPIFLASH_FAST_READ 0x01  /* use 0x0B instead of 0x03 */
+
+/* USBASP_FUNC_UART_READ status, first byte of reply */
+#define USBASP_UART_OVERRUN     0x01  /* received bytes were lost */
+#define USBASP_UART_FRAME       0x02  /* stop bit missing */
+
+/* USBASP_FUNC_DW_RESULT status, first byte of reply, data follows */
+#define USBASP_DW_OK            0
+#define USBASP_DW_PENDING       1     /* operation not run yet */
+#define USBASP_DW_ERROR         2     /* no answer, not in dW mode,
+                                         read count over 63 or capture
+                                         running */
+
+/* USBASP_FUNC_UPDI_CONNECT options */
+#define USBASP_UPDI_NVMPROG     0x01  /* enter NVM programming mode */
+
+/* ISP macro operations (see USBASP_FUNC_MACRO_STORE), operands follow */
+#define ISP_MACRO_END           0x00
+#define ISP_MACRO_SEND          0x01  /* 4 instruction bytes */
+#define ISP_MACRO_EXPECT        0x02  /* index, mask, value of last answer */
+#define ISP_MACRO_POLL          0x03  /* SEND and EXPECT operands, timeout */
+#define ISP_MACRO_WAIT          0x04  /* n x 320 us */
+#define ISP_MACRO_RST           0x05  /* 0 = low, 1 = high */
+#define ISP_MACRO_SCK           0x06  /* SCK option */
+
+/* ISP macro result status */
+#define ISP_MACRO_OK            0
+#define ISP_MACRO_MISMATCH      1
+#define ISP_MACRO_TIMEOUT       2
+#define ISP_MACRO_INVALID       3
+
+/* ISP macro storage in EEPROM */
+#define ISP_MACRO_SLOTS         8
+#define ISP_MACRO_SIZE          32
+
+/* memory types of byte counters (see USBASP_FUNC_COUNTERS) */
+#define PROG_COUNT_FLASH        0
+#define PROG_COUNT_EEPROM       1
+#define PROG_COUNT_OTHER        2   /* TPI, bridges, external memories */
+#define PROG_COUNT_TYPES        3
+
+/* buffer for raw transfers (TPI sequence, SPI bridge) */
+#define PROG_BUFFER_SIZE        64
+
+/* USBASP_FUNC_SETTINGS operations */
+#define USBASP_SETTINGS_READ    0
+#define USBASP_SETTINGS_STORE   1   /* family (0x00 AVR, 0xFF AT89S) and
+                                       SCK option follow, invalid ones
+                                       are not stored */
+#define USBASP_SETTINGS_CLEAR   2
+
+/* persisted settings flags */
+#define PROG_SETTINGS_TARGET    0x01  /* family and SCK option valid */
+#define PROG_SETTINGS_PROFILE   0x02  /* timing profile valid */
 
 /* programming state */
 #define PROG_STATE_IDLE         0
@@ -41,6 +194,42 @@
 #define PROG_STATE_WRITEEEPROM  4
 #define PROG_STATE_TPI_READ     5
 #define PROG_STATE_TPI_WRITE    6
+#define PROG_STATE_SETPROFILE   7
+#define PROG_STATE_TPI_SCRIPT   8
+#define PROG_STATE_SPI_TRANSFER 9
+#define PROG_STATE_SPIFLASH_READ  10
+#define PROG_STATE_SPIFLASH_WRITE 11
+#define PROG_STATE_I2C_READ     12
+#define PROG_STATE_I2C_WRITE    13
+#define PROG_STATE_UART_READ    14
+#define PROG_STATE_UART_WRITE   15
+#define PROG_STATE_PDI_READ     16
+#define PROG_STATE_PDI_WRITE    17
+#define PROG_STATE_UPDI_READ    18
+#define PROG_STATE_UPDI_WRITE   19
+#define PROG_STATE_JTAG_READ    20
+#define PROG_STATE_JTAG_WRITE   21
+#define PROG_STATE_CAPTURE_READ 22
+#define PROG_STATE_MACRO_STORE  23
+#define PROG_STATE_TRACE_READ   24
+
+/* connection mode */
+#define PROG_MODE_ISP           0
+#define PROG_MODE_TPI           1
+#define PROG_MODE_SPI           2
+#define PROG_MODE_I2C           3
+#define PROG_MODE_UART          4
+#define PROG_MODE_PDI           5
+#define PROG_MODE_UPDI          6
+#define PROG_MODE_JTAG          7
+#define PROG_MODE_DW            8
+#define PROG_MODE_CAPTURE       9
+
+/* debugWIRE operation run from main loop after status stage */
+#define PROG_DW_NONE            0
+#define PROG_DW_CONNECT         1
+#define PROG_DW_READ            2
+#define PROG_DW_DISABLE         3
 
 /* Block mode flags */
 #define PROG_BLOCKFLAG_FIRST    1